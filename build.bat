@@ -1,3 +1,3 @@
 @echo off
 
-cl /Z7 /EHsc /W3 /MTd loki_integration_tests.cpp loki_test_cases.cpp
+cl /Z7 /std:c++20 /EHsc /W3 /MTd loki_integration_tests.cpp loki_test_cases.cpp
@@ -0,0 +1,681 @@
+#ifndef LOKI_ASYNC_H
+#define LOKI_ASYNC_H
+
+// Define LOKI_ASYNC_IMPLEMENTATION in one CPP file
+
+//
+// Header
+//
+#include <stdint.h>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// NOTE: Coroutines resumed by a small pool of event loop threads. Awaiting IPC, sleeps and timers
+// suspends the coroutine instead of blocking a thread, so any number of scenarios or actors can be in
+// flight on a couple of threads. Blocking code gets the result of a coroutine with itest_sync_wait.
+//
+// Coroutines must never block, i.e. call the synchronous IPC functions, they'd stall every other
+// coroutine on the same loop. co_await the _async version instead.
+
+struct itest_event_loop_;
+struct itest_async_waiter_;
+
+// NOTE: Cancelling a token resumes every sleep and fd wait suspended under it and they throw
+// itest_cancelled, as does every wait started afterwards. The token is inherited by everything
+// resumed on behalf of the thread or coroutine that set it, see itest_async_set_cancel_token.
+struct itest_cancelled {};
+struct itest_cancel_token
+{
+  std::mutex                         mutex;
+  bool                               cancelled;
+  std::vector<itest_async_waiter_ *> waiters;
+};
+void itest_cancel(itest_cancel_token *token);
+
+int const           ITEST_DEFAULT_EVENT_LOOPS = 2;
+void                itest_async_init                (int num_event_loops); // Optional, call before the first coroutine runs
+bool                itest_async_on_loop_thread      ();
+itest_cancel_token *itest_async_current_cancel_token();
+void                itest_async_set_cancel_token    (itest_cancel_token *token); // For threads that aren't event loops
+void                itest_async_post                (std::coroutine_handle<> handle, itest_cancel_token *token = itest_async_current_cancel_token()); // Resume handle on one of the event loops
+
+// -------------------------------------------------------------------------------------------------
+//
+// itest_task
+//
+// -------------------------------------------------------------------------------------------------
+// NOTE: Lazily started, nothing runs until the task is awaited or handed to itest_sync_wait/itest_async_spawn.
+// Finishing resumes whoever awaited the task, exceptions are rethrown in the awaiter.
+template <typename T> struct itest_task;
+
+struct itest_task_promise_base
+{
+  std::coroutine_handle<> continuation;
+  std::exception_ptr      exception;
+
+  struct final_awaiter
+  {
+    bool await_ready() noexcept { return false; }
+    void await_resume() noexcept {}
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+    {
+      std::coroutine_handle<> result = handle.promise().continuation;
+      if (!result) result = std::noop_coroutine();
+      return result;
+    }
+  };
+
+  std::suspend_always initial_suspend    () noexcept { return {}; }
+  final_awaiter       final_suspend      () noexcept { return {}; }
+  void                unhandled_exception()          { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct itest_task_promise : itest_task_promise_base
+{
+  T             value = {};
+  itest_task<T> get_return_object();
+  void          return_value(T result) { value = std::move(result); }
+};
+
+template <>
+struct itest_task_promise<void> : itest_task_promise_base
+{
+  itest_task<void> get_return_object();
+  void             return_void() {}
+};
+
+template <typename T>
+struct itest_task
+{
+  using promise_type = itest_task_promise<T>;
+  std::coroutine_handle<promise_type> handle;
+
+  itest_task() = default;
+  explicit itest_task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+  itest_task(itest_task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  itest_task(itest_task const &) = delete;
+  ~itest_task() { if (handle) handle.destroy(); }
+
+  itest_task &operator=(itest_task &&other) noexcept
+  {
+    if (this != &other)
+    {
+      if (handle) handle.destroy();
+      handle = std::exchange(other.handle, {});
+    }
+    return *this;
+  }
+
+  bool                    await_ready  () const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+  {
+    handle.promise().continuation = awaiter;
+    return handle;
+  }
+
+  T await_resume()
+  {
+    if (handle.promise().exception) std::rethrow_exception(handle.promise().exception);
+    if constexpr (!std::is_void_v<T>) return std::move(handle.promise().value);
+  }
+};
+
+template <typename T>
+itest_task<T> itest_task_promise<T>::get_return_object()
+{
+  return itest_task<T>(std::coroutine_handle<itest_task_promise<T>>::from_promise(*this));
+}
+
+inline itest_task<void> itest_task_promise<void>::get_return_object()
+{
+  return itest_task<void>(std::coroutine_handle<itest_task_promise<void>>::from_promise(*this));
+}
+
+// NOTE: Fire and forget coroutine that frees itself once it finishes, used to start tasks on the loops
+struct itest_detached_task
+{
+  struct promise_type
+  {
+    itest_detached_task get_return_object  () { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_always initial_suspend    () noexcept { return {}; }
+    std::suspend_never  final_suspend      () noexcept { return {}; }
+    void                return_void        () {}
+    void                unhandled_exception() { std::terminate(); }
+  };
+  std::coroutine_handle<promise_type> handle;
+};
+
+// -------------------------------------------------------------------------------------------------
+//
+// awaitables
+//
+// -------------------------------------------------------------------------------------------------
+struct itest_async_waiter_
+{
+  itest_event_loop_      *loop;
+  itest_cancel_token     *token;
+  std::coroutine_handle<> handle;
+  int                     fd;        // -1 if waiting on a timer
+  bool                    cancelled;
+};
+
+struct itest_async_sleep : itest_async_waiter_
+{
+  int  ms;
+  bool await_ready  () const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> handle);
+  void await_resume ();
+};
+
+// NOTE: Resumes once the fd is readable/writable or hung up, await_resume returns the epoll events
+// that fired. The fd must be a pipe, socket or similar that supports epoll.
+struct itest_async_fd_wait : itest_async_waiter_
+{
+  uint32_t events;
+  uint32_t revents;
+  int      error;
+
+  bool     await_ready  () const noexcept { return false; }
+  bool     await_suspend(std::coroutine_handle<> handle);
+  uint32_t await_resume ();
+};
+
+// NOTE: Resumes once the future is ready, await_resume returns or rethrows its result. For blocking
+// work that can't be a coroutine, i.e. opening a process's pipes. A thread waits on the future and posts
+// the coroutine back to an event loop, the loop itself never blocks and nothing is polled.
+template <typename T>
+struct itest_async_future_wait
+{
+  std::future<T> *future;
+
+  bool await_ready() const { return future->wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+  void await_suspend(std::coroutine_handle<> handle)
+  {
+    itest_cancel_token *token = itest_async_current_cancel_token();
+    std::thread([future = future, handle, token]() {
+      future->wait();
+      itest_async_post(handle, token);
+    }).detach();
+  }
+  T await_resume() { return future->get(); }
+};
+
+template <typename T>
+itest_async_future_wait<T> itest_async_wait_future(std::future<T> *future) { return {future}; }
+
+itest_async_sleep   itest_async_sleep_ms     (int ms);
+itest_async_fd_wait itest_async_wait_readable(int fd);
+itest_async_fd_wait itest_async_wait_writable(int fd);
+bool                itest_async_fd_hung_up   (uint32_t revents);
+
+// -------------------------------------------------------------------------------------------------
+//
+// running tasks
+//
+// -------------------------------------------------------------------------------------------------
+template <typename T, typename Callback>
+itest_detached_task itest_async_spawn_(itest_task<T> task, Callback on_done)
+{
+  if constexpr (std::is_void_v<T>)
+  {
+    co_await task;
+    on_done();
+  }
+  else
+  {
+    on_done(co_await task);
+  }
+}
+
+// NOTE: Start the task on an event loop and return immediately, on_done is called on the loop thread
+// with the result. The task must not throw, there's nobody to catch it.
+template <typename T, typename Callback>
+void itest_async_spawn(itest_task<T> task, Callback on_done, itest_cancel_token *token = itest_async_current_cancel_token())
+{
+  itest_async_post(itest_async_spawn_(std::move(task), std::move(on_done)).handle, token);
+}
+
+template <typename T>
+itest_detached_task itest_sync_wait_(itest_task<T> task, std::shared_ptr<std::promise<T>> promise)
+{
+  try
+  {
+    if constexpr (std::is_void_v<T>)
+    {
+      co_await task;
+      promise->set_value();
+    }
+    else
+    {
+      promise->set_value(co_await task);
+    }
+  }
+  catch (...)
+  {
+    promise->set_exception(std::current_exception());
+  }
+}
+
+// NOTE: Start the task on an event loop and return a future for its result, the task inherits the
+// thread's cancel token and anything it throws is rethrown from the future. Lets a thread run several
+// tasks at once before waiting on them.
+template <typename T>
+std::future<T> itest_async_future(itest_task<T> task)
+{
+  auto promise          = std::make_shared<std::promise<T>>();
+  std::future<T> result = promise->get_future();
+  itest_async_post(itest_sync_wait_(std::move(task), promise).handle);
+  return result;
+}
+
+// NOTE: Waits on every future before rethrowing the first failure. The tasks borrow the caller's state,
+// i.e. the scenario's cancel token and the pipes of its processes, so unwinding on the first exception
+// would leave the rest suspended on state the caller is about to free.
+template <typename T>
+std::vector<T> itest_async_get_all(std::vector<std::future<T>> *futures)
+{
+  std::vector<T> result;
+  result.reserve(futures->size());
+  std::exception_ptr error = nullptr;
+  for (std::future<T> &future : *futures)
+  {
+    try { result.push_back(future.get()); }
+    catch (...) { if (!error) error = std::current_exception(); }
+  }
+
+  futures->clear();
+  if (error) std::rethrow_exception(error);
+  return result;
+}
+
+// NOTE: Block the calling thread until the task finishes on an event loop, the task inherits the
+// thread's cancel token. Calling this from a coroutine would block the loop it's running on and can
+// deadlock waiting on itself.
+template <typename T>
+T itest_sync_wait(itest_task<T> task)
+{
+  LOKI_ASSERT_MSG(!itest_async_on_loop_thread(), "Blocking wait from inside a coroutine, co_await the task instead");
+  return itest_async_future(std::move(task)).get();
+}
+
+#endif // LOKI_ASYNC_H
+
+//
+// CPP Implementation
+//
+#ifdef LOKI_ASYNC_IMPLEMENTATION
+#if defined(_WIN32)
+#error "Please implement"
+#else
+  #include <errno.h>
+  #include <sys/epoll.h>   // epoll_create1, epoll_ctl, epoll_wait
+  #include <sys/eventfd.h> // eventfd
+  #include <unistd.h>      // read, write
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct itest_async_resumable_
+{
+  std::coroutine_handle<> handle;
+  itest_cancel_token     *token;
+};
+
+struct itest_async_timer_
+{
+  std::chrono::steady_clock::time_point deadline;
+  itest_async_waiter_                  *waiter;
+  bool operator>(itest_async_timer_ const &other) const { return deadline > other.deadline; }
+};
+
+struct itest_event_loop_
+{
+  int                                 epoll_fd;
+  int                                 wake_fd;
+  std::mutex                          mutex;
+  std::vector<itest_async_resumable_> posted;
+  std::vector<itest_async_timer_>     timers;  // Min heap on the deadline
+  std::vector<itest_async_waiter_ *>  cancels; // Waiters suspended on this loop whose token was cancelled
+};
+
+struct itest_async_pool_
+{
+  std::vector<itest_event_loop_ *> loops;
+  std::atomic<unsigned>            next_loop;
+};
+
+FILE_SCOPE std::atomic<int> itest_async_num_event_loops_(ITEST_DEFAULT_EVENT_LOOPS);
+FILE_SCOPE thread_local itest_event_loop_  *itest_async_current_loop_;
+FILE_SCOPE thread_local itest_cancel_token *itest_async_current_token_;
+
+FILE_SCOPE void itest_async_wake_(itest_event_loop_ *loop)
+{
+  uint64_t one = 1;
+  ssize_t bytes_written = write(loop->wake_fd, &one, sizeof(one));
+  (void)bytes_written; // NOTE: Only fails if the counter is saturated, the loop is already awake then
+}
+
+// NOTE: Called with the loop locked. The waiter is only resumed if it was still suspended, an fd that
+// fired or a timer that expired this iteration is already queued to resume and throws from there.
+FILE_SCOPE bool itest_async_unregister_waiter_(itest_event_loop_ *loop, itest_async_waiter_ *waiter)
+{
+  bool result = false;
+  if (waiter->fd == -1)
+  {
+    auto it = std::find_if(loop->timers.begin(), loop->timers.end(), [waiter](itest_async_timer_ const &timer) { return timer.waiter == waiter; });
+    if (it != loop->timers.end())
+    {
+      loop->timers.erase(it);
+      std::make_heap(loop->timers.begin(), loop->timers.end(), std::greater<itest_async_timer_>());
+      result = true;
+    }
+  }
+  else
+  {
+    result = epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, waiter->fd, nullptr) == 0;
+  }
+  return result;
+}
+
+FILE_SCOPE void itest_async_run_loop_(itest_event_loop_ *loop)
+{
+  itest_async_current_loop_ = loop;
+  std::vector<itest_async_resumable_> ready;
+  for (;;)
+  {
+    int timeout_ms = -1;
+    {
+      std::lock_guard<std::mutex> lock(loop->mutex);
+      if (loop->posted.size() || loop->cancels.size())
+      {
+        timeout_ms = 0;
+      }
+      else if (loop->timers.size())
+      {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(loop->timers.front().deadline - std::chrono::steady_clock::now()).count();
+        timeout_ms     = static_cast<int>(LOKI_MAX(remaining, 0));
+      }
+    }
+
+    epoll_event events[64];
+    int num_events = epoll_wait(loop->epoll_fd, events, LOKI_ARRAY_COUNT(events), timeout_ms);
+    if (num_events == -1 && errno != EINTR)
+      perror("Event loop epoll_wait(...) failed");
+
+    for (int i = 0; i < num_events; i++)
+    {
+      if (!events[i].data.ptr)
+      {
+        uint64_t count = 0;
+        ssize_t bytes_read = read(loop->wake_fd, &count, sizeof(count));
+        (void)bytes_read;
+        continue;
+      }
+
+      auto *waiter    = static_cast<itest_async_fd_wait *>(events[i].data.ptr);
+      waiter->revents = events[i].events;
+      epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, waiter->fd, nullptr);
+      ready.push_back({waiter->handle, waiter->token});
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(loop->mutex);
+      ready.insert(ready.end(), loop->posted.begin(), loop->posted.end());
+      loop->posted.clear();
+
+      auto now = std::chrono::steady_clock::now();
+      while (loop->timers.size() && loop->timers.front().deadline <= now)
+      {
+        std::pop_heap(loop->timers.begin(), loop->timers.end(), std::greater<itest_async_timer_>());
+        itest_async_waiter_ *waiter = loop->timers.back().waiter;
+        ready.push_back({waiter->handle, waiter->token});
+        loop->timers.pop_back();
+      }
+
+      for (itest_async_waiter_ *waiter : loop->cancels)
+      {
+        if (itest_async_unregister_waiter_(loop, waiter))
+        {
+          waiter->cancelled = true;
+          ready.push_back({waiter->handle, waiter->token});
+        }
+      }
+      loop->cancels.clear();
+    }
+
+    for (itest_async_resumable_ const &resumable : ready)
+    {
+      itest_async_current_token_ = resumable.token;
+      resumable.handle.resume();
+    }
+    itest_async_current_token_ = nullptr;
+    ready.clear();
+  }
+}
+
+FILE_SCOPE itest_async_pool_ *itest_async_pool()
+{
+  // NOTE: Never freed, the loops run until the process exits
+  LOCAL_PERSIST itest_async_pool_ *const result = []() {
+    auto *pool = new itest_async_pool_();
+    for (int i = 0; i < LOKI_MAX(itest_async_num_event_loops_.load(), 1); i++)
+    {
+      auto *loop     = new itest_event_loop_();
+      loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      loop->wake_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      LOKI_ASSERT_MSG(loop->epoll_fd != -1 && loop->wake_fd != -1, "Failed to create event loop: %s", strerror(errno));
+
+      epoll_event wake_event = {};
+      wake_event.events      = EPOLLIN;
+      wake_event.data.ptr    = nullptr;
+      epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &wake_event);
+
+      pool->loops.push_back(loop);
+      std::thread(itest_async_run_loop_, loop).detach();
+    }
+    return pool;
+  }();
+  return result;
+}
+
+// NOTE: Stay on the loop the coroutine is already running on, otherwise spread work over the pool
+FILE_SCOPE itest_event_loop_ *itest_async_pick_loop_()
+{
+  if (itest_async_current_loop_)
+    return itest_async_current_loop_;
+
+  itest_async_pool_ *pool   = itest_async_pool();
+  itest_event_loop_ *result = pool->loops[pool->next_loop++ % pool->loops.size()];
+  return result;
+}
+
+void itest_async_init(int num_event_loops)
+{
+  itest_async_num_event_loops_ = num_event_loops;
+  itest_async_pool();
+}
+
+bool itest_async_on_loop_thread()
+{
+  bool result = itest_async_current_loop_ != nullptr;
+  return result;
+}
+
+itest_cancel_token *itest_async_current_cancel_token()
+{
+  return itest_async_current_token_;
+}
+
+void itest_async_set_cancel_token(itest_cancel_token *token)
+{
+  LOKI_ASSERT_MSG(!itest_async_on_loop_thread(), "Event loops switch the token per coroutine, it can't be set on them");
+  itest_async_current_token_ = token;
+}
+
+void itest_async_post(std::coroutine_handle<> handle, itest_cancel_token *token)
+{
+  itest_event_loop_ *loop = itest_async_pick_loop_();
+  {
+    std::lock_guard<std::mutex> lock(loop->mutex);
+    loop->posted.push_back({handle, token});
+  }
+  itest_async_wake_(loop);
+}
+
+void itest_cancel(itest_cancel_token *token)
+{
+  std::lock_guard<std::mutex> lock(token->mutex);
+  if (token->cancelled)
+    return;
+
+  token->cancelled = true;
+  for (itest_async_waiter_ *waiter : token->waiters)
+  {
+    {
+      std::lock_guard<std::mutex> loop_lock(waiter->loop->mutex);
+      waiter->loop->cancels.push_back(waiter);
+    }
+    itest_async_wake_(waiter->loop);
+  }
+}
+
+// NOTE: Registers the waiter with its token and suspends it via the suspend callback. Both happen under
+// the token lock so a cancel can't slip in between and miss the waiter. Returns false to resume
+// immediately, which throws from await_resume if the token was already cancelled.
+template <typename Suspend>
+FILE_SCOPE bool itest_async_suspend_waiter_(itest_async_waiter_ *waiter, std::coroutine_handle<> handle, Suspend suspend)
+{
+  waiter->handle = handle;
+  waiter->loop   = itest_async_pick_loop_();
+  waiter->token  = itest_async_current_token_;
+  if (!waiter->token)
+    return suspend();
+
+  std::lock_guard<std::mutex> lock(waiter->token->mutex);
+  if (waiter->token->cancelled)
+  {
+    waiter->cancelled = true;
+    return false;
+  }
+
+  bool result = suspend();
+  if (result)
+    waiter->token->waiters.push_back(waiter);
+  return result;
+}
+
+FILE_SCOPE void itest_async_resume_waiter_(itest_async_waiter_ *waiter)
+{
+  bool cancelled = waiter->cancelled;
+  if (waiter->token)
+  {
+    {
+      std::lock_guard<std::mutex> lock(waiter->token->mutex);
+      auto &waiters = waiter->token->waiters;
+      waiters.erase(std::remove(waiters.begin(), waiters.end(), waiter), waiters.end());
+      cancelled |= waiter->token->cancelled;
+    }
+
+    // NOTE: The token may have been cancelled after the waiter was queued to resume, drop the pending
+    // cancel before the waiter goes out of scope.
+    std::lock_guard<std::mutex> lock(waiter->loop->mutex);
+    auto &cancels = waiter->loop->cancels;
+    cancels.erase(std::remove(cancels.begin(), cancels.end(), waiter), cancels.end());
+  }
+
+  if (cancelled)
+    throw itest_cancelled();
+}
+
+itest_async_sleep itest_async_sleep_ms(int ms)
+{
+  itest_async_sleep result = {};
+  result.fd                = -1;
+  result.ms                = ms;
+  return result;
+}
+
+bool itest_async_sleep::await_suspend(std::coroutine_handle<> handle)
+{
+  bool result = itest_async_suspend_waiter_(this, handle, [this]() {
+    itest_event_loop_ *timer_loop = loop; // NOTE: The timer can fire on another loop once it's unlocked
+    {
+      std::lock_guard<std::mutex> lock(timer_loop->mutex);
+      timer_loop->timers.push_back({std::chrono::steady_clock::now() + std::chrono::milliseconds(ms), this});
+      std::push_heap(timer_loop->timers.begin(), timer_loop->timers.end(), std::greater<itest_async_timer_>());
+    }
+    itest_async_wake_(timer_loop);
+    return true;
+  });
+  return result;
+}
+
+void itest_async_sleep::await_resume()
+{
+  itest_async_resume_waiter_(this);
+}
+
+bool itest_async_fd_wait::await_suspend(std::coroutine_handle<> handle)
+{
+  // NOTE: The event can fire and resume the coroutine on the loop thread before epoll_ctl returns, so
+  // everything the loop reads is set beforehand and this awaiter isn't touched afterwards on success.
+  bool result = itest_async_suspend_waiter_(this, handle, [this]() {
+    epoll_event event = {};
+    event.events      = events | EPOLLONESHOT;
+    event.data.ptr    = this;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+      error   = errno;
+      revents = EPOLLERR;
+      return false; // NOTE: Resume immediately, the caller's next read/write reports the error
+    }
+    return true;
+  });
+  return result;
+}
+
+uint32_t itest_async_fd_wait::await_resume()
+{
+  itest_async_resume_waiter_(this);
+  return revents;
+}
+
+itest_async_fd_wait itest_async_wait_readable(int fd)
+{
+  itest_async_fd_wait result = {};
+  result.fd                  = fd;
+  result.events              = EPOLLIN;
+  return result;
+}
+
+itest_async_fd_wait itest_async_wait_writable(int fd)
+{
+  itest_async_fd_wait result = {};
+  result.fd                  = fd;
+  result.events              = EPOLLOUT;
+  return result;
+}
+
+bool itest_async_fd_hung_up(uint32_t revents)
+{
+  bool result = (revents & (EPOLLHUP | EPOLLERR)) && !(revents & EPOLLIN);
+  return result;
+}
+#endif // LOKI_ASYNC_IMPLEMENTATION
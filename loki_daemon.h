@@ -45,12 +45,28 @@ struct daemon_checkpoint
   }
 };
 
+// NOTE: Two daemons agree on the chain when both the height and the hash of the top block match
+struct daemon_chain_tip
+{
+  uint64_t    height;
+  loki_hash64 top_block_hash;
+
+  bool operator==(daemon_chain_tip const &other) const
+  {
+    bool result = (height == other.height && top_block_hash == other.top_block_hash);
+    return result;
+  }
+};
+
 void                           daemon_exit                 (daemon_t *daemon);
+itest_task<void>               daemon_exit_async           (daemon_t *daemon);
 bool                           daemon_prepare_registration (daemon_t *daemon, daemon_prepare_registration_params const *params, loki_fixed_string<> *registration_cmd);
 std::vector<daemon_checkpoint> daemon_print_checkpoints    (daemon_t *daemon);
+itest_task<std::vector<daemon_checkpoint>> daemon_print_checkpoints_async(daemon_t *daemon);
 uint64_t                       daemon_print_height         (daemon_t *daemon);
 daemon_snode_status            daemon_print_sn             (daemon_t *daemon, loki_snode_key const *key); // TODO(doyle): We can't request the entire sn list because this needs a big buffer and I cbb doing mem management over shared mem
 bool                           daemon_print_sn_key         (daemon_t *daemon, loki_snode_key *key);
+itest_task<bool>               daemon_print_sn_key_async   (daemon_t *daemon, loki_snode_key *key);
 daemon_snode_status            daemon_print_sn_status      (daemon_t *daemon); // return: If the node is known on the network (i.e. registered)
 uint64_t                       daemon_print_sr             (daemon_t *daemon, uint64_t height);
 bool                           daemon_print_tx             (daemon_t *daemon, char const *tx_id, std::string *output);
@@ -60,7 +76,10 @@ bool                           daemon_ban                  (daemon_t *daemon, lo
 bool                           daemon_unban                (daemon_t *daemon, loki_fixed_string<32> const *ip);
 bool                           daemon_set_log              (daemon_t *daemon, int level);
 daemon_status_t                daemon_status               (daemon_t *daemon);
+itest_task<daemon_status_t>    daemon_status_async         (daemon_t *daemon);
 bool                           daemon_print_block          (daemon_t *daemon, uint64_t height, loki_hash64 *block_hash);
+itest_task<bool>               daemon_print_block_async    (daemon_t *daemon, uint64_t height, loki_hash64 *block_hash);
+itest_task<daemon_chain_tip>   daemon_chain_tip_async      (daemon_t *daemon);
 
 // NOTE: This command is only available in integration mode, compiled out otherwise in the daemon
 void                daemon_relay_votes_and_uptime(daemon_t *daemon);
@@ -75,6 +94,59 @@ void                daemon_toggle_obligation_quorum(daemon_t *daemon);
 void                daemon_toggle_obligation_uptime_proof(daemon_t *daemon);
 void                daemon_toggle_obligation_checkpointing(daemon_t *daemon);
 
+// NOTE: Commands fired at a set of daemons that each daemon acknowledges with a fixed reply
+enum struct daemon_broadcast_cmd
+{
+  relay_votes_and_uptime,
+  toggle_checkpoint_quorum,
+  toggle_obligation_quorum,
+  toggle_obligation_uptime_proof,
+  toggle_obligation_checkpointing,
+};
+
+// NOTE: Acks that haven't been waited on are waited on when the broadcast is destroyed or replaced, i.e.
+// when the caller unwinds mid-broadcast. Their coroutines are still using the daemons' pipes.
+struct daemon_broadcast_acks
+{
+  daemon_t                       *daemons = nullptr;
+  daemon_broadcast_cmd            cmd     = {};
+  std::vector<std::future<float>> acks; // Per daemon, resolves to the ms it took to acknowledge
+
+  daemon_broadcast_acks() = default;
+  daemon_broadcast_acks(daemon_broadcast_acks &&other) = default;
+  daemon_broadcast_acks &operator=(daemon_broadcast_acks &&other)
+  {
+    drain();
+    daemons = other.daemons;
+    cmd     = other.cmd;
+    acks    = std::move(other.acks);
+    other.acks.clear();
+    return *this;
+  }
+  ~daemon_broadcast_acks() { drain(); }
+
+  void drain()
+  {
+    for (std::future<float> &ack : acks)
+      if (ack.valid()) ack.wait();
+    acks.clear();
+  }
+};
+
+struct daemon_broadcast_result
+{
+  std::vector<float> latency_ms; // Per daemon, in the order the daemons were given
+  int                slowest;    // Index of the daemon that took the longest, -1 if there were none
+};
+
+// NOTE: Sends the command to every daemon at once and gathers the acknowledgements. Daemons that take
+// longer than DAEMON_BROADCAST_SLOW_MS to acknowledge are reported. Start returns immediately, nothing
+// else may be sent to the daemons until the broadcast has been waited on.
+int const               DAEMON_BROADCAST_SLOW_MS = 1000;
+daemon_broadcast_acks   daemon_broadcast_start(daemon_t *daemons, int num_daemons, daemon_broadcast_cmd cmd);
+daemon_broadcast_result daemon_broadcast_wait (daemon_broadcast_acks *broadcast);
+daemon_broadcast_result daemon_broadcast      (daemon_t *daemons, int num_daemons, daemon_broadcast_cmd cmd);
+
 #endif // LOKI_DAEMON_H
 
 //
@@ -96,20 +168,25 @@ void daemon_exit(daemon_t *daemon)
   itest_ipc_clean_up(&daemon->ipc);
 }
 
-std::vector<daemon_checkpoint> daemon_print_checkpoints(daemon_t *daemon)
+itest_task<void> daemon_exit_async(daemon_t *daemon)
 {
-  itest_read_possible_value const possible_values[] =
-  {
-    {LOKI_STRING("No Checkpoints"), true},
-    {LOKI_STRING("Type"), false},
-  };
+  co_await itest_write_to_stdin_async(&daemon->ipc, "exit");
+  itest_ipc_clean_up(&daemon->ipc);
+}
+
+static itest_read_possible_value const DAEMON_PRINT_CHECKPOINTS_POSSIBLE_VALUES[] =
+{
+  {LOKI_STRING("No Checkpoints"), true},
+  {LOKI_STRING("Type"), false},
+};
 
+static std::vector<daemon_checkpoint> daemon_parse_checkpoints(itest_read_result const *output)
+{
   std::vector<daemon_checkpoint> result;
-  itest_read_result output = itest_write_then_read_stdout_until(&daemon->ipc, "print_checkpoints", possible_values, LOKI_ARRAY_COUNT(possible_values));
-  if (possible_values[output.matching_find_strs_index].is_fail_msg)
+  if (DAEMON_PRINT_CHECKPOINTS_POSSIBLE_VALUES[output->matching_find_strs_index].is_fail_msg)
     return result;
 
-  char const *ptr = output.buf.c_str();
+  char const *ptr = output->buf.c_str();
   for (ptr = str_find(ptr, "Type: "); ptr; ptr = str_find(ptr, "Type: "))
   {
     char const *type_value   = str_skip_to_next_word_inplace(&ptr);
@@ -129,6 +206,20 @@ std::vector<daemon_checkpoint> daemon_print_checkpoints(daemon_t *daemon)
   return result;
 }
 
+std::vector<daemon_checkpoint> daemon_print_checkpoints(daemon_t *daemon)
+{
+  itest_read_result output              = itest_write_then_read_stdout_until(&daemon->ipc, "print_checkpoints", DAEMON_PRINT_CHECKPOINTS_POSSIBLE_VALUES, LOKI_ARRAY_COUNT(DAEMON_PRINT_CHECKPOINTS_POSSIBLE_VALUES));
+  std::vector<daemon_checkpoint> result = daemon_parse_checkpoints(&output);
+  return result;
+}
+
+itest_task<std::vector<daemon_checkpoint>> daemon_print_checkpoints_async(daemon_t *daemon)
+{
+  itest_read_result output              = co_await itest_write_then_read_stdout_until_async(&daemon->ipc, "print_checkpoints", DAEMON_PRINT_CHECKPOINTS_POSSIBLE_VALUES, LOKI_ARRAY_COUNT(DAEMON_PRINT_CHECKPOINTS_POSSIBLE_VALUES));
+  std::vector<daemon_checkpoint> result = daemon_parse_checkpoints(&output);
+  co_return result;
+}
+
 uint64_t daemon_print_height(daemon_t *daemon)
 {
   itest_read_result output = itest_write_then_read_stdout(&daemon->ipc, "print_height");
@@ -307,10 +398,9 @@ daemon_snode_status daemon_print_sn(daemon_t *daemon, loki_snode_key const *key)
   return result;
 }
 
-bool daemon_print_sn_key(daemon_t *daemon, loki_snode_key *key)
+static bool daemon_parse_sn_key(itest_read_result const *output, loki_snode_key *key)
 {
-  itest_read_result output = itest_write_then_read_stdout_until(&daemon->ipc, "print_sn_key", LOKI_STRING("Service Node Public Key: "));
-  char const *key_ptr = str_find(output.buf.c_str(), ":");
+  char const *key_ptr = str_find(output->buf.c_str(), ":");
   key_ptr = str_skip_to_next_alphanum(key_ptr);
 
   if (key)
@@ -322,6 +412,20 @@ bool daemon_print_sn_key(daemon_t *daemon, loki_snode_key *key)
   return true;
 }
 
+bool daemon_print_sn_key(daemon_t *daemon, loki_snode_key *key)
+{
+  itest_read_result output = itest_write_then_read_stdout_until(&daemon->ipc, "print_sn_key", LOKI_STRING("Service Node Public Key: "));
+  bool result              = daemon_parse_sn_key(&output, key);
+  return result;
+}
+
+itest_task<bool> daemon_print_sn_key_async(daemon_t *daemon, loki_snode_key *key)
+{
+  itest_read_result output = co_await itest_write_then_read_stdout_until_async(&daemon->ipc, "print_sn_key", LOKI_STRING("Service Node Public Key: "));
+  bool result              = daemon_parse_sn_key(&output, key);
+  co_return result;
+}
+
 daemon_snode_status daemon_print_sn_status(daemon_t *daemon)
 {
 
@@ -486,27 +590,92 @@ bool daemon_set_log(daemon_t *daemon, int level)
   return true;
 }
 
+struct daemon_broadcast_cmd_info
+{
+  char const  *cmd;
+  loki_string  ack;
+};
+
+static daemon_broadcast_cmd_info const DAEMON_BROADCAST_CMDS[] =
+{
+  {"relay_votes_and_uptime",                           LOKI_STRING("Votes and uptime relayed")},
+  {"integration_test toggle_checkpoint_quorum",        LOKI_STRING("toggle_checkpoint_quorum toggled")},
+  {"integration_test toggle_obligation_quorum",        LOKI_STRING("toggle_obligation_quorum toggled")},
+  {"integration_test toggle_obligation_uptime_proof",  LOKI_STRING("toggle_obligation_uptime_proof toggled")},
+  {"integration_test toggle_obligation_checkpointing", LOKI_STRING("toggle_obligation_checkpointing toggled")},
+};
+
+static void daemon_send_broadcast_cmd(daemon_t *daemon, daemon_broadcast_cmd cmd)
+{
+  daemon_broadcast_cmd_info const *info = DAEMON_BROADCAST_CMDS + static_cast<int>(cmd);
+  itest_write_then_read_stdout_until(&daemon->ipc, info->cmd, info->ack);
+}
+
+static itest_task<float> daemon_send_broadcast_cmd_async(daemon_t *daemon, daemon_broadcast_cmd cmd)
+{
+  daemon_broadcast_cmd_info const *info = DAEMON_BROADCAST_CMDS + static_cast<int>(cmd);
+  auto start_time                       = std::chrono::steady_clock::now();
+  co_await itest_write_then_read_stdout_until_async(&daemon->ipc, info->cmd, info->ack);
+  float result = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+  co_return result;
+}
+
+daemon_broadcast_acks daemon_broadcast_start(daemon_t *daemons, int num_daemons, daemon_broadcast_cmd cmd)
+{
+  daemon_broadcast_acks result = {};
+  result.daemons               = daemons;
+  result.cmd                   = cmd;
+  result.acks.reserve(num_daemons);
+  LOKI_FOR_EACH(daemon_index, num_daemons)
+    result.acks.push_back(itest_async_future(daemon_send_broadcast_cmd_async(daemons + daemon_index, cmd)));
+  return result;
+}
+
+daemon_broadcast_result daemon_broadcast_wait(daemon_broadcast_acks *broadcast)
+{
+  daemon_broadcast_result result = {};
+  result.slowest                 = -1;
+  result.latency_ms              = itest_async_get_all(&broadcast->acks);
+  LOKI_FOR_EACH(daemon_index, result.latency_ms.size())
+  {
+    float latency_ms = result.latency_ms[daemon_index];
+    if (result.slowest == -1 || latency_ms > result.latency_ms[result.slowest])
+      result.slowest = static_cast<int>(daemon_index);
+
+    if (latency_ms > DAEMON_BROADCAST_SLOW_MS)
+      fprintf(stderr, "Slow broadcast: daemon_%d took %.0fms to acknowledge %s\n", broadcast->daemons[daemon_index].id, latency_ms, DAEMON_BROADCAST_CMDS[static_cast<int>(broadcast->cmd)].cmd);
+  }
+
+  return result;
+}
+
+daemon_broadcast_result daemon_broadcast(daemon_t *daemons, int num_daemons, daemon_broadcast_cmd cmd)
+{
+  daemon_broadcast_acks broadcast = daemon_broadcast_start(daemons, num_daemons, cmd);
+  daemon_broadcast_result result  = daemon_broadcast_wait(&broadcast);
+  return result;
+}
+
 void daemon_relay_votes_and_uptime(daemon_t *daemon)
 {
-  itest_write_then_read_stdout_until(&daemon->ipc, "relay_votes_and_uptime", LOKI_STRING("Votes and uptime relayed"));
+  daemon_send_broadcast_cmd(daemon, daemon_broadcast_cmd::relay_votes_and_uptime);
 }
 
-daemon_status_t daemon_status(daemon_t *daemon)
+static itest_read_possible_value const DAEMON_STATUS_POSSIBLE_VALUES[] =
+{
+  {LOKI_STRING("Error: Problem fetching info -- "), true},
+  {LOKI_STRING("Height: "), false},
+};
+
+static daemon_status_t daemon_parse_status(itest_read_result const *output)
 {
   // Example:
   // Height: 67/67 (100.0%) on testnet, not mining, net hash 4 H/s, v9, up to date, 0(out)+0(in) connections, uptime 0d 0h 0m 0s
-  itest_read_possible_value const possible_values[] =
-  {
-    {LOKI_STRING("Error: Problem fetching info -- "), true},
-    {LOKI_STRING("Height: "), false},
-  };
-
-  itest_read_result output = itest_write_then_read_stdout_until(&daemon->ipc, "status", possible_values, LOKI_ARRAY_COUNT(possible_values));
-  if (possible_values[output.matching_find_strs_index].is_fail_msg)
+  if (DAEMON_STATUS_POSSIBLE_VALUES[output->matching_find_strs_index].is_fail_msg)
     return {};
 
   daemon_status_t result = {};
-  char const *ptr        = output.buf.c_str();
+  char const *ptr        = output->buf.c_str();
   char const *height_str = str_skip_to_next_digit_inplace(&ptr);
   result.height          = atoi(height_str);
 
@@ -518,26 +687,64 @@ daemon_status_t daemon_status(daemon_t *daemon)
   return result;
 }
 
-bool daemon_print_block(daemon_t *daemon, uint64_t height, loki_hash64 *block_hash)
+daemon_status_t daemon_status(daemon_t *daemon)
 {
-  loki_fixed_string<64> cmd("print_block %zu", height);
-  itest_read_possible_value const possible_values[] =
-  {
-    {LOKI_STRING("Error: Unsuccessful --"), true},
-    {LOKI_STRING("timestamp: "), false},
-  };
+  itest_read_result output = itest_write_then_read_stdout_until(&daemon->ipc, "status", DAEMON_STATUS_POSSIBLE_VALUES, LOKI_ARRAY_COUNT(DAEMON_STATUS_POSSIBLE_VALUES));
+  daemon_status_t result   = daemon_parse_status(&output);
+  return result;
+}
 
-  itest_read_result read_result = itest_write_then_read_stdout_until(&daemon->ipc, cmd.str, possible_values, LOKI_ARRAY_COUNT(possible_values));
-  if (possible_values[read_result.matching_find_strs_index].is_fail_msg)
+itest_task<daemon_status_t> daemon_status_async(daemon_t *daemon)
+{
+  itest_read_result output = co_await itest_write_then_read_stdout_until_async(&daemon->ipc, "status", DAEMON_STATUS_POSSIBLE_VALUES, LOKI_ARRAY_COUNT(DAEMON_STATUS_POSSIBLE_VALUES));
+  daemon_status_t result   = daemon_parse_status(&output);
+  co_return result;
+}
+
+static itest_read_possible_value const DAEMON_PRINT_BLOCK_POSSIBLE_VALUES[] =
+{
+  {LOKI_STRING("Error: Unsuccessful --"), true},
+  {LOKI_STRING("timestamp: "), false},
+};
+
+static bool daemon_parse_block_hash(itest_read_result const *output, loki_hash64 *block_hash)
+{
+  if (DAEMON_PRINT_BLOCK_POSSIBLE_VALUES[output->matching_find_strs_index].is_fail_msg)
     return false;
 
-  char const *ptr        = read_result.buf.c_str();
+  char const *ptr        = output->buf.c_str();
   char const *hash_label = str_find(ptr, "hash: ");
   char const *hash       = str_skip_to_next_word(hash_label);
   *block_hash            = hash;
   return true;
 }
 
+bool daemon_print_block(daemon_t *daemon, uint64_t height, loki_hash64 *block_hash)
+{
+  loki_fixed_string<64> cmd("print_block %zu", height);
+  itest_read_result read_result = itest_write_then_read_stdout_until(&daemon->ipc, cmd.str, DAEMON_PRINT_BLOCK_POSSIBLE_VALUES, LOKI_ARRAY_COUNT(DAEMON_PRINT_BLOCK_POSSIBLE_VALUES));
+  bool result                   = daemon_parse_block_hash(&read_result, block_hash);
+  return result;
+}
+
+itest_task<bool> daemon_print_block_async(daemon_t *daemon, uint64_t height, loki_hash64 *block_hash)
+{
+  loki_fixed_string<64> cmd("print_block %zu", height);
+  itest_read_result read_result = co_await itest_write_then_read_stdout_until_async(&daemon->ipc, cmd.str, DAEMON_PRINT_BLOCK_POSSIBLE_VALUES, LOKI_ARRAY_COUNT(DAEMON_PRINT_BLOCK_POSSIBLE_VALUES));
+  bool result                   = daemon_parse_block_hash(&read_result, block_hash);
+  co_return result;
+}
+
+itest_task<daemon_chain_tip> daemon_chain_tip_async(daemon_t *daemon)
+{
+  daemon_chain_tip result = {};
+  daemon_status_t status  = co_await daemon_status_async(daemon);
+  result.height           = status.height;
+  if (result.height > 0 && !co_await daemon_print_block_async(daemon, result.height - 1, &result.top_block_hash))
+    result.top_block_hash.clear();
+  co_return result;
+}
+
 bool daemon_mine_n_blocks(daemon_t *daemon, wallet_t *wallet, int num_blocks)
 {
   loki_addr addr = {};
@@ -552,6 +759,9 @@ bool daemon_mine_n_blocks(daemon_t *daemon, wallet_t *wallet, int num_blocks)
 
 void daemon_mine_n_blocks(daemon_t *daemon, loki_addr const *addr, int num_blocks)
 {
+  if (num_blocks <= 0)
+    return;
+
   itest_read_possible_value const possible_values[] =
   {
     {LOKI_STRING("Mining stopped in daemon"), false},
@@ -601,26 +811,22 @@ bool daemon_mine_until_height(daemon_t *daemon, wallet_t *wallet, uint64_t desir
 
 void daemon_toggle_checkpoint_quorum(daemon_t *daemon)
 {
-  loki_fixed_string<256> cmd("integration_test toggle_checkpoint_quorum");
-  itest_write_then_read_stdout_until(&daemon->ipc, cmd.str, LOKI_STRING("toggle_checkpoint_quorum toggled"));
+  daemon_send_broadcast_cmd(daemon, daemon_broadcast_cmd::toggle_checkpoint_quorum);
 }
 
 void daemon_toggle_obligation_quorum(daemon_t *daemon)
 {
-  loki_fixed_string<256> cmd("integration_test toggle_obligation_quorum");
-  itest_write_then_read_stdout_until(&daemon->ipc, cmd.str, LOKI_STRING("toggle_obligation_quorum toggled"));
+  daemon_send_broadcast_cmd(daemon, daemon_broadcast_cmd::toggle_obligation_quorum);
 }
 
 void daemon_toggle_obligation_uptime_proof(daemon_t *daemon)
 {
-  loki_fixed_string<256> cmd("integration_test toggle_obligation_uptime_proof");
-  itest_write_then_read_stdout_until(&daemon->ipc, cmd.str, LOKI_STRING("toggle_obligation_uptime_proof toggled"));
+  daemon_send_broadcast_cmd(daemon, daemon_broadcast_cmd::toggle_obligation_uptime_proof);
 }
 
 void daemon_toggle_obligation_checkpointing(daemon_t *daemon)
 {
-  loki_fixed_string<256> cmd("integration_test toggle_obligation_checkpointing");
-  itest_write_then_read_stdout_until(&daemon->ipc, cmd.str, LOKI_STRING("toggle_obligation_checkpointing toggled"));
+  daemon_send_broadcast_cmd(daemon, daemon_broadcast_cmd::toggle_obligation_checkpointing);
 }
 
 #endif // LOKI_DAEMON_IMPLEMENTATION
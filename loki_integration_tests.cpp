@@ -7,18 +7,182 @@
 #define LOKI_OS_IMPLEMENTATION
 #include "loki_os.h"
 
+#define LOKI_ASYNC_IMPLEMENTATION
+#include "loki_async.h"
+
 #include "loki_daemon.h"
 #include "loki_str.h"
 #include <atomic>
+#include <cmath>
 
 #define XTERM_CMD 1
+
+// -------------------------------------------------------------------------------------------------
+//
+// itest_launch_args
+//
+// -------------------------------------------------------------------------------------------------
+void itest_launch_args::add(char const *fmt, ...)
+{
+  va_list va;
+  va_start(va, fmt);
+  va_list va_copy_for_len;
+  va_copy(va_copy_for_len, va);
+  int len = stbsp_vsnprintf(nullptr, 0, fmt, va_copy_for_len);
+  va_end(va_copy_for_len);
+
+  std::string arg(len, 0);
+  stbsp_vsnprintf(&arg[0], len + 1, fmt, va);
+  va_end(va);
+  args.push_back(std::move(arg));
+}
+
+// NOTE: Follows the shell's quoting rules without expanding anything, single quotes are taken
+// literally, a backslash escapes the next character outside of them and \ " $ ` inside double quotes.
+void itest_launch_args::add_cmd_line(char const *cmd_line)
+{
+  std::string arg;
+  bool in_arg = false;
+  char quote  = 0;
+  for (char const *ptr = cmd_line; ptr[0]; ptr++)
+  {
+    char ch = ptr[0];
+    if (quote == '\'')
+    {
+      if (ch == '\'') quote = 0;
+      else            arg += ch;
+    }
+    else if (quote == '"')
+    {
+      if (ch == '"')                                            quote = 0;
+      else if (ch == '\\' && ptr[1] && strchr("\\\"$`", ptr[1])) arg += *(++ptr);
+      else                                                      arg += ch;
+    }
+    else if (char_is_whitespace(ch))
+    {
+      if (in_arg) args.push_back(std::move(arg));
+      arg.clear();
+      in_arg = false;
+    }
+    else
+    {
+      in_arg = true;
+      if (ch == '\'' || ch == '"')    quote = ch;
+      else if (ch == '\\' && ptr[1]) arg += *(++ptr);
+      else                            arg += ch;
+    }
+  }
+
+  if (in_arg) args.push_back(std::move(arg));
+}
+
+std::string itest_launch_args::to_shell_cmd() const
+{
+  std::string result;
+  for (std::string const &arg : args)
+  {
+    bool needs_quotes = arg.empty();
+    for (char ch : arg)
+    {
+      if (!(char_is_alphanum(ch) || strchr("_-./:=,@%+", ch)))
+      {
+        needs_quotes = true;
+        break;
+      }
+    }
+
+    if (result.size()) result += ' ';
+    if (!needs_quotes)
+    {
+      result += arg;
+      continue;
+    }
+
+    result += '\'';
+    for (char ch : arg)
+    {
+      if (ch == '\'') result += "'\\''";
+      else             result += ch;
+    }
+    result += '\'';
+  }
+  return result;
+}
+
+// NOTE: The terminal starts the program in a session of its own, killing the terminal's process group
+// doesn't reach it. Only use a terminal when someone is watching, unattended runs exec the program
+// directly so a timeout or Ctrl-C can kill it for certain.
+FILE_SCOPE bool terminals_attended()
+{
+  LOCAL_PERSIST bool const result = isatty(STDOUT_FILENO) && getenv("DISPLAY");
+  return result;
+}
+
+// NOTE: Processes are launched in their own terminal so that their output can be watched. Appends the
+// terminal then the program, or just the program and returns false if it isn't wrapped in a terminal.
+FILE_SCOPE bool add_terminal_launch_args(itest_launch_args *args, char const *title, bool keep_terminal_open, itest_launch_args const *program)
+{
+#if LXTERMINAL_CMD || XTERM_CMD
+  bool result = terminals_attended();
+#else
+  bool result = false;
+#endif
+  if (!result)
+  {
+    args->args.insert(args->args.end(), program->args.begin(), program->args.end());
+    return result;
+  }
+
 #if LXTERMINAL_CMD
-char const LOKI_CMD_FMT[]        = "lxterminal -t \"daemon_%d %s\" -e bash -c \"./lokid %s; %s \"";
-char const LOKI_WALLET_CMD_FMT[] = "lxterminal -t \"wallet_%d %s\" -e bash -c \"./loki-wallet-cli %s; %s \"";
+  // NOTE: lxterminal joins everything after -e and parses it like a shell would, so pass the program
+  // as one quoted string. It has no -hold, the shell waits for enter before the terminal closes.
+  args->add("lxterminal");
+  args->add("-t");
+  args->add("%s", title);
+  args->add("-e");
+  if (keep_terminal_open)
+  {
+    itest_launch_args hold = {};
+    hold.add("sh");
+    hold.add("-c");
+    hold.add("%s; read _", program->to_shell_cmd().c_str());
+    args->add("%s", hold.to_shell_cmd().c_str());
+  }
+  else
+  {
+    args->add("%s", program->to_shell_cmd().c_str());
+  }
 #elif XTERM_CMD
-char const LOKI_CMD_FMT[]        = "xterm -T \"daemon_%d %s\" -e bash -c \"./lokid %s; %s \"";
-char const LOKI_WALLET_CMD_FMT[] = "xterm -T \"wallet_%d %s\" -e bash -c \"./loki-wallet-cli %s; %s \"";
+  args->add("xterm");
+  args->add("-T");
+  args->add("%s", title);
+  if (keep_terminal_open) args->add("-hold");
+  args->add("-e");
+  args->args.insert(args->args.end(), program->args.begin(), program->args.end());
 #endif
+  return result;
+}
+
+// NOTE: What the watchdog needs to time out a scenario. The context is the cancel token of the
+// scenario so it follows the scenario into the event loops and the threads it starts.
+struct itest_scenario_context : itest_cancel_token
+{
+  std::chrono::steady_clock::time_point start_time;
+  std::chrono::steady_clock::time_point deadline;
+  std::mutex                            pids_mutex; // Guards pids and last_cmd, not the cancel state, that is under itest_cancel_token::mutex
+  std::vector<int>                      pids;       // Every process the scenario launched, kill with itest_kill_process
+  os_cpu_set                            cpus;       // Pinned to, inherited by every process the scenario launches
+  loki_fixed_string<256>                last_cmd;   // The last command written to one of its processes
+  std::atomic<bool>                     timed_out;
+  bool                                  processes_killed; // By the watchdog, guarded by the work queue's mutex
+};
+
+// NOTE: Every cancel token set by the harness is a scenario context
+FILE_SCOPE itest_scenario_context *itest_current_scenario()
+{
+  auto *result = static_cast<itest_scenario_context *>(itest_async_current_cancel_token());
+  return result;
+}
 
 // -------------------------------------------------------------------------------------------------
 //
@@ -30,8 +194,11 @@ char const WALLET_IPC_NAME[] = "loki_integration_testing_wallet";
 
 void itest_ipc_clean_up(itest_ipc *ipc)
 {
-  close(ipc->read.fd);
-  close(ipc->write.fd);
+  // NOTE: Safe to call more than once, a stale fd could otherwise close a descriptor another thread reopened
+  if (ipc->read.fd > 0)  close(ipc->read.fd);
+  if (ipc->write.fd > 0) close(ipc->write.fd);
+  ipc->read.fd  = -1;
+  ipc->write.fd = -1;
   unlink(ipc->read.file.str);
   unlink(ipc->write.file.str);
 }
@@ -55,7 +222,17 @@ FILE_SCOPE void itest_ipc_open_pipes(itest_ipc *ipc)
     assert(false);
   }
 
-  ipc->write.fd = open(ipc->write.file.str, O_WRONLY);
+  // NOTE: Opening the write end only succeeds once the process has opened its end of the pipe. It's
+  // polled rather than opened blocking so a process that never connects can still be timed out, and
+  // non-blocking from here on so a full pipe suspends the writing coroutine instead of an event loop.
+  int const CONNECT_POLL_MS = 10;
+  for (;;)
+  {
+    ipc->write.fd = open(ipc->write.file.str, O_WRONLY | O_NONBLOCK);
+    if (ipc->write.fd != -1 || errno != ENXIO) break;
+    itest_sleep_ms(CONNECT_POLL_MS);
+  }
+
   if (ipc->write.fd == -1)
   {
     perror("Failed to open write pipe");
@@ -72,6 +249,34 @@ FILE_SCOPE itest_ipc itest_ipc_setup(char const *base_name, int id)
   return result;
 }
 
+// NOTE: Every process is waited on before the first failure is rethrown, the rest would otherwise still
+// be setting up their pipes when the caller cleans up the processes they belong to.
+void itest_wait_until_ready(itest_ready_futures *futures)
+{
+  std::exception_ptr error = nullptr;
+  for (std::future<void> &ready : *futures)
+  {
+    try { ready.get(); }
+    catch (...) { if (!error) error = std::current_exception(); }
+  }
+
+  futures->clear();
+  if (error) std::rethrow_exception(error);
+}
+
+itest_task<void> itest_wait_until_ready_async(itest_ready_futures *futures)
+{
+  std::exception_ptr error = nullptr;
+  for (std::future<void> &ready : *futures)
+  {
+    try { co_await itest_async_wait_future(&ready); }
+    catch (...) { if (!error) error = std::current_exception(); }
+  }
+
+  futures->clear();
+  if (error) std::rethrow_exception(error);
+}
+
 // -------------------------------------------------------------------------------------------------
 //
 // start_daemon_params
@@ -114,6 +319,42 @@ void start_daemon_params::load_latest_hardfork_versions()
   this->add_hardfork(13, 6);
 }
 
+// -------------------------------------------------------------------------------------------------
+//
+// block planning
+//
+// -------------------------------------------------------------------------------------------------
+// NOTE: From hardfork 8 the base reward decays from 128 towards 28 LOKI, halving the decaying part
+// every 64800 blocks. The miner keeps 45% of it, the rest goes to the service nodes and governance.
+// Earlier forks pay the miner more so the plan over-mines there rather than falling short.
+uint64_t loki_miner_reward(uint64_t height)
+{
+  double const base_reward = 28000000000.0 + (100000000000.0 / std::exp2(height / (720.0 * 90.0)));
+  uint64_t result          = static_cast<uint64_t>(base_reward * 0.45);
+  return result;
+}
+
+uint64_t loki_blocks_until_mined_reward(uint64_t height, uint64_t atomic_amount)
+{
+  uint64_t result = 0;
+  for (uint64_t mined = 0; mined < atomic_amount; result++)
+    mined += loki_miner_reward(height + result);
+  return result;
+}
+
+uint64_t loki_blocks_until_unlocked_reward(uint64_t height, uint64_t atomic_amount)
+{
+  uint64_t result = loki_blocks_until_mined_reward(height, atomic_amount);
+  if (result > 0) result += LOKI_CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW;
+  return result;
+}
+
+uint64_t loki_blocks_until_height(uint64_t height, uint64_t min_height)
+{
+  uint64_t result = (height < min_height) ? min_height - height : 0;
+  return result;
+}
+
 uint32_t const MSG_PACKET_MAGIC = 0x27befd93;
 struct msg_packet
 {
@@ -143,16 +384,35 @@ static char const *make_msg_packet(char const *src, int *len, msg_packet *dest)
 // itest
 //
 // -------------------------------------------------------------------------------------------------
-void itest_write_to_stdin(itest_ipc *ipc, char const *src)
+itest_task<void> itest_write_to_stdin_async(itest_ipc *ipc, char const *src)
 {
+  if (itest_scenario_context *context = itest_current_scenario())
+  {
+    std::lock_guard<std::mutex> lock(context->pids_mutex);
+    context->last_cmd = loki_fixed_string<256>("%s", src);
+  }
+
   int src_len = static_cast<int>(strlen(src));
   while (src_len > 0)
   {
     msg_packet packet = {};
     src               = make_msg_packet(src, &src_len, &packet);
-    int num_bytes_written = write(ipc->write.fd, static_cast<void *>(&packet), sizeof(packet));
-    if (num_bytes_written == -1)
+    for (;;)
     {
+      // NOTE: Packets are smaller than PIPE_BUF so the write is all or nothing
+      int num_bytes_written = write(ipc->write.fd, static_cast<void *>(&packet), sizeof(packet));
+      if (num_bytes_written != -1)
+        break;
+
+      if (errno == EINTR)
+        continue;
+
+      if (errno == EAGAIN)
+      {
+        co_await itest_async_wait_writable(ipc->write.fd);
+        continue;
+      }
+
       if (errno == EBADF)
       {
         static thread_local bool printed_once = false;
@@ -161,42 +421,35 @@ void itest_write_to_stdin(itest_ipc *ipc, char const *src)
           perror("Error returned from write(...)");
           printed_once = true;
         }
-        return;
-      }
-      else
-      {
-        perror("Error returned from write(...)");
+        co_return;
       }
+
+      perror("Error returned from write(...)");
+      break;
     }
   }
 }
 
-itest_read_result itest_write_then_read_stdout(itest_ipc *ipc, char const *src)
-{
-  itest_write_to_stdin(ipc, src);
-  itest_read_result result = itest_read_stdout(ipc);
-  return result;
-}
-
-itest_read_result itest_write_then_read_stdout_until(itest_ipc *ipc, char const *src, itest_read_possible_value const *possible_values, int possible_values_len)
+itest_task<itest_read_result> itest_write_then_read_stdout_until_async(itest_ipc *ipc, char const *src, itest_read_possible_value const *possible_values, int possible_values_len)
 {
-  itest_write_to_stdin(ipc, src);
-  itest_read_result result = itest_read_stdout_until(ipc, possible_values, possible_values_len);
-  return result;
+  co_await itest_write_to_stdin_async(ipc, src);
+  itest_read_result result = co_await itest_read_stdout_until_async(ipc, possible_values, possible_values_len);
+  co_return result;
 }
 
-itest_read_result itest_write_then_read_stdout_until(itest_ipc *ipc, char const *cmd, loki_string find_str)
+itest_task<itest_read_result> itest_write_then_read_stdout_until_async(itest_ipc *ipc, char const *src, loki_string find_str)
 {
   itest_read_possible_value possible_values[] = { {find_str, false}, };
-  itest_read_result result = itest_write_then_read_stdout_until(ipc, cmd, possible_values, 1);
-  return result;
+  itest_read_result result = co_await itest_write_then_read_stdout_until_async(ipc, src, possible_values, 1);
+  co_return result;
 }
 
-itest_read_result itest_read_stdout(itest_ipc *ipc)
+itest_task<itest_read_result> itest_read_stdout_async(itest_ipc *ipc)
 {
   if (ipc->read.fd == 0)
   {
-    ipc->read.fd = open(ipc->read.file.str, O_RDONLY);
+    // NOTE: Non-blocking so the open doesn't wait for the process to connect, reads suspend instead
+    ipc->read.fd = open(ipc->read.file.str, O_RDONLY | O_NONBLOCK);
     if (ipc->read.fd == -1)
     {
       perror("Failed to open write pipe");
@@ -207,29 +460,53 @@ itest_read_result itest_read_stdout(itest_ipc *ipc)
   itest_read_result result = {};
   for (;;)
   {
-    msg_packet packet = {};
-    int bytes_read    = read(ipc->read.fd, reinterpret_cast<void *>(&packet), sizeof(packet));
-    if (bytes_read == -1)
+    msg_packet packet     = {};
+    int        packet_len = 0;
+    uint32_t   revents    = 0;
+    while (packet_len < static_cast<int>(sizeof(packet)))
     {
-      if (errno == EBADF)
+      char *dest     = reinterpret_cast<char *>(&packet) + packet_len;
+      int bytes_read = read(ipc->read.fd, static_cast<void *>(dest), sizeof(packet) - packet_len);
+      if (bytes_read > 0)
       {
-        static thread_local bool printed_once = false;
-        if (!printed_once)
+        packet_len += bytes_read;
+        continue;
+      }
+
+      if (bytes_read == -1 && errno == EINTR)
+        continue;
+
+      // NOTE: A FIFO reads 0 bytes until the process connects its end, it's only cut once epoll says
+      // the writer hung up.
+      if ((bytes_read == -1 && errno == EAGAIN) || (bytes_read == 0 && !itest_async_fd_hung_up(revents)))
+      {
+        revents = co_await itest_async_wait_readable(ipc->read.fd);
+        continue;
+      }
+
+      if (bytes_read == -1)
+      {
+        if (errno == EBADF)
+        {
+          static thread_local bool printed_once = false;
+          if (!printed_once)
+          {
+            perror("Error returned from write(...)");
+            printed_once = true;
+          }
+          co_return result;
+        }
+        else
         {
           perror("Error returned from write(...)");
-          printed_once = true;
         }
-        return result;
-      }
-      else
-      {
-        perror("Error returned from write(...)");
       }
+      break;
     }
 
-    if (bytes_read < static_cast<int>(sizeof(packet)))
+    if (packet_len < static_cast<int>(sizeof(packet)))
     {
-      fprintf(stderr, "Error reading packet from pipe expected=%zu, read=%d, possible that the pipe was cut mid-transmission\n", sizeof(packet), bytes_read);
+      fprintf(stderr, "Error reading packet from pipe expected=%zu, read=%d, possible that the pipe was cut mid-transmission\n", sizeof(packet), packet_len);
       exit(-1);
     }
 
@@ -245,6 +522,61 @@ itest_read_result itest_read_stdout(itest_ipc *ipc)
     result.buf.append(packet.buf, packet.len);
     if (!packet.has_more) break;
   }
+  co_return result;
+}
+
+itest_task<itest_read_result> itest_read_stdout_until_async(itest_ipc *ipc, char const *find_str)
+{
+  itest_read_possible_value possible_values[] = { {find_str, false}, };
+  itest_read_result result = co_await itest_read_stdout_until_async(ipc, possible_values, 1);
+  co_return result;
+}
+
+itest_task<itest_read_result> itest_read_stdout_until_async(itest_ipc *ipc, itest_read_possible_value const *possible_values, int possible_values_len)
+{
+  for (;;)
+  {
+    itest_read_result result = co_await itest_read_stdout_async(ipc);
+    LOKI_FOR_EACH(i, possible_values_len)
+    {
+      char const *check = result.buf.c_str();
+      if (str_find(check, possible_values[i].literal.str))
+      {
+        result.matching_find_strs_index = i;
+        co_return result;
+      }
+    }
+  }
+}
+
+void itest_write_to_stdin(itest_ipc *ipc, char const *src)
+{
+  itest_sync_wait(itest_write_to_stdin_async(ipc, src));
+}
+
+itest_read_result itest_write_then_read_stdout(itest_ipc *ipc, char const *src)
+{
+  itest_write_to_stdin(ipc, src);
+  itest_read_result result = itest_read_stdout(ipc);
+  return result;
+}
+
+itest_read_result itest_write_then_read_stdout_until(itest_ipc *ipc, char const *src, itest_read_possible_value const *possible_values, int possible_values_len)
+{
+  itest_read_result result = itest_sync_wait(itest_write_then_read_stdout_until_async(ipc, src, possible_values, possible_values_len));
+  return result;
+}
+
+itest_read_result itest_write_then_read_stdout_until(itest_ipc *ipc, char const *cmd, loki_string find_str)
+{
+  itest_read_possible_value possible_values[] = { {find_str, false}, };
+  itest_read_result result = itest_write_then_read_stdout_until(ipc, cmd, possible_values, 1);
+  return result;
+}
+
+itest_read_result itest_read_stdout(itest_ipc *ipc)
+{
+  itest_read_result result = itest_sync_wait(itest_read_stdout_async(ipc));
   return result;
 }
 
@@ -260,256 +592,1931 @@ void itest_read_stdout_sink(itest_ipc *pipe, int seconds)
   // TODO(doyle): implement
 }
 
-itest_read_result itest_read_stdout_until(itest_ipc *ipc, itest_read_possible_value const *possible_values, int possible_values_len)
-{
-  for (;;)
+void itest_sleep_ms(int ms)
+{
+  itest_sync_wait([](int ms) -> itest_task<void> { co_await itest_async_sleep_ms(ms); }(ms));
+}
+
+itest_read_result itest_read_stdout_until(itest_ipc *ipc, itest_read_possible_value const *possible_values, int possible_values_len)
+{
+  itest_read_result result = itest_sync_wait(itest_read_stdout_until_async(ipc, possible_values, possible_values_len));
+  return result;
+}
+
+void itest_read_until_then_write_stdin(itest_ipc *ipc, loki_string find_str, char const *cmd)
+{
+  itest_read_stdout_until(ipc, find_str.str);
+  itest_write_to_stdin(ipc, cmd);
+}
+
+// -------------------------------------------------------------------------------------------------
+//
+// daemon
+//
+// -------------------------------------------------------------------------------------------------
+struct state_t
+{
+  std::atomic<int> num_wallets         = 0;
+  std::atomic<int> num_daemons         = 0;
+  std::atomic<int> free_p2p_port       = 1111;
+  std::atomic<int> free_rpc_port       = 2222;
+  std::atomic<int> free_zmq_port       = 3333;
+  std::atomic<int> free_quorumnet_port = 4444;
+
+  // NOTE: Overridden when sharding so harness processes on the same host don't share files
+  loki_fixed_string<128> output_dir      = loki_fixed_string<128>("./output");
+  loki_fixed_string<128> daemon_ipc_name = loki_fixed_string<128>(DAEMON_IPC_NAME);
+  loki_fixed_string<128> wallet_ipc_name = loki_fixed_string<128>(WALLET_IPC_NAME);
+
+  // NOTE: Off in isolated workers, their processes stay in the worker's group so killing the worker kills them
+  bool process_groups = true;
+};
+FILE_SCOPE state_t global_state;
+
+// NOTE: Each process leads its own process group so killing it takes down anything it started too.
+// Processes not in a terminal write their output to <output_dir>/<name>.log.
+FILE_SCOPE int launch_process(itest_launch_args const *program, char const *name, char const *terminal_name, bool keep_terminal_open)
+{
+  loki_fixed_string<512> title("%s %s", name, terminal_name);
+  itest_launch_args launch_args = {};
+  bool const in_terminal        = add_terminal_launch_args(&launch_args, title.str, keep_terminal_open, program);
+
+  std::vector<char const *> argv;
+  argv.reserve(launch_args.args.size() + 1);
+  for (std::string const &arg : launch_args.args)
+    argv.push_back(arg.c_str());
+  argv.push_back(nullptr);
+
+  loki_fixed_string<256> log_path("%s/%s.log", global_state.output_dir.str, name);
+  itest_scenario_context *context = itest_current_scenario();
+  int result                      = os_spawn_process(argv.data(), context ? context->cpus : os_cpu_set{}, global_state.process_groups, in_terminal ? nullptr : log_path.str);
+  if (context)
+  {
+    std::lock_guard<std::mutex> lock(context->pids_mutex);
+    context->pids.push_back(result);
+  }
+  return result;
+}
+
+void itest_kill_process(int pid)
+{
+  if (global_state.process_groups) os_kill_process_group(pid);
+  else                             os_kill_process(pid);
+}
+
+// NOTE: Each port counter has a range of 1111 ports before running into the next counter's range.
+// Shards move the whole set of ranges up so co-located shards never allocate the same port. The last
+// shard's quorumnet range, the highest, must end below 65535 so the shard count is capped.
+int const ITEST_PORTS_PER_COUNTER    = 1111;
+int const ITEST_LAST_PORT            = 4444 + ITEST_PORTS_PER_COUNTER - 1; // End of the unsharded quorumnet range
+int const ITEST_SHARD_PORT_STRIDE    = 9000;
+int const ITEST_MAX_COLOCATED_SHARDS = 7;
+static_assert(ITEST_LAST_PORT + ((ITEST_MAX_COLOCATED_SHARDS - 1) * ITEST_SHARD_PORT_STRIDE) <= 65535, "The last shard's ports would overflow");
+
+FILE_SCOPE void itest_use_shard(int shard_index)
+{
+  assert(shard_index < ITEST_MAX_COLOCATED_SHARDS);
+  int const port_offset = shard_index * ITEST_SHARD_PORT_STRIDE;
+  global_state.free_p2p_port       += port_offset;
+  global_state.free_rpc_port       += port_offset;
+  global_state.free_zmq_port       += port_offset;
+  global_state.free_quorumnet_port += port_offset;
+  global_state.output_dir           = loki_fixed_string<128>("./output_shard%d", shard_index);
+  global_state.daemon_ipc_name      = loki_fixed_string<128>("loki_integration_testing_shard%d_daemon", shard_index);
+  global_state.wallet_ipc_name      = loki_fixed_string<128>("loki_integration_testing_shard%d_wallet", shard_index);
+}
+
+// NOTE: Isolated workers are separate processes with their own copy of the counters, each takes a
+// slice of the port ranges and its own files and pipes like a shard would.
+FILE_SCOPE void itest_use_worker(int worker_index, int num_workers)
+{
+  int const port_offset = worker_index * (ITEST_PORTS_PER_COUNTER / num_workers);
+  global_state.free_p2p_port       += port_offset;
+  global_state.free_rpc_port       += port_offset;
+  global_state.free_zmq_port       += port_offset;
+  global_state.free_quorumnet_port += port_offset;
+  global_state.output_dir           = loki_fixed_string<128>("%s/worker%d", global_state.output_dir.str, worker_index);
+  global_state.daemon_ipc_name      = loki_fixed_string<128>("%s_worker%d", global_state.daemon_ipc_name.str, worker_index);
+  global_state.wallet_ipc_name      = loki_fixed_string<128>("%s_worker%d", global_state.wallet_ipc_name.str, worker_index);
+}
+
+daemon_t create_daemon()
+{
+  daemon_t result       = {};
+  result.id             = global_state.num_daemons++;
+  result.p2p_port       = global_state.free_p2p_port++;
+  result.rpc_port       = global_state.free_rpc_port++;
+  result.zmq_rpc_port   = global_state.free_zmq_port++;
+  result.quorumnet_port = global_state.free_quorumnet_port++;
+  return result;
+}
+
+loki_fixed_string<256> daemon_data_dir(daemon_t const *daemon)
+{
+  loki_fixed_string<256> result("%s/daemon_%d", global_state.output_dir.str, daemon->id);
+  return result;
+}
+
+// NOTE: Per-daemon identity that must not be inherited from a template data dir. Service node keys,
+// the P2P peer id (duplicate ids get dropped as a connection to ourselves) and the LMDB lock file. The
+// fixture cache keeps the keys when it restores because it brings back the same daemons, whereas a
+// template seeds new daemons that each need an identity of their own.
+FILE_SCOPE char const *const DAEMON_TEMPLATE_SKIP_FILES[] = {"key", "key_ed25519", "p2pstate.bin", "lock.mdb"};
+
+void daemon_launch_spec::add_exclusive_nodes(daemon_t const *peers, int num_peers)
+{
+  exclusive_node_ports.reserve(exclusive_node_ports.size() + num_peers);
+  LOKI_FOR_EACH(peer_index, num_peers)
+  {
+    daemon_t const *peer = peers + peer_index;
+    if (peer != daemon) exclusive_node_ports.push_back(peer->p2p_port);
+  }
+}
+
+itest_launch_args daemon_launch_spec::build() const
+{
+  itest_launch_args result = {};
+  result.add("./lokid");
+  result.add("--data-dir");           result.add("%s", data_dir.str);
+  result.add("--p2p-bind-port");      result.add("%d", daemon->p2p_port);
+  result.add("--rpc-bind-port");      result.add("%d", daemon->rpc_port);
+  result.add("--zmq-rpc-bind-port");  result.add("%d", daemon->zmq_rpc_port);
+  result.add("--quorumnet-port");     result.add("%d", daemon->quorumnet_port);
+  result.add("--dev-allow-local-ips");
+
+  if (log_level >= 0)
+  {
+    result.add("--log-level");
+    result.add("%d", log_level);
+  }
+
+  if (offline)
+    result.add("--offline");
+
+  if (storage_server_port > 0)
+  {
+    result.add("--storage-server-port");    result.add("%d", storage_server_port);
+    result.add("--service-node-public-ip"); result.add("123.123.123.123");
+  }
+
+  if (params.service_node)
+    result.add("--service-node");
+
+  if (params.fixed_difficulty > 0)
+  {
+    result.add("--fixed-difficulty");
+    result.add("%d", params.fixed_difficulty);
+  }
+
+  if (integration_test_mode && params.num_hardforks > 0)
+  {
+    std::string hardforks;
+    for (int i = 0; i < params.num_hardforks; ++i)
+    {
+      loki_hardfork hardfork = params.hardforks[i];
+      if (i) hardforks += ", ";
+      hardforks += std::to_string(hardfork.version) + ":" + std::to_string(hardfork.height);
+    }
+
+    result.add("--integration-test-hardforks-override");
+    result.add("%s", hardforks.c_str());
+    LOKI_ASSERT(params.nettype == loki_nettype::fakenet);
+  }
+  else
+  {
+    if (params.nettype == loki_nettype::testnet)
+      result.add("--testnet");
+    else if (params.nettype == loki_nettype::stagenet)
+      result.add("--stagenet");
+  }
+
+  if (integration_test_mode)
+  {
+    result.add("--integration-test-pipe-name");
+    result.add("%s%d", global_state.daemon_ipc_name.str, daemon->id);
+  }
+
+  for (int port : exclusive_node_ports)
+  {
+    result.add("--add-exclusive-node");
+    result.add("127.0.0.1:%d", port);
+  }
+
+  result.add_cmd_line(params.custom_cmd_line.str);
+
+  return result;
+}
+
+itest_ready_futures start_daemon_async(daemon_t *daemons, int num_daemons, start_daemon_params *params, int num_params, char const *terminal_name)
+{
+  itest_ready_futures result;
+  result.reserve(num_daemons);
+
+  LOKI_ASSERT(num_params == num_daemons || num_params == 1);
+  for (int curr_daemon_index = 0; curr_daemon_index < num_daemons; ++curr_daemon_index)
+  {
+    daemon_t *curr_daemon = daemons + curr_daemon_index;
+
+    daemon_launch_spec spec = {};
+    spec.daemon             = curr_daemon;
+    spec.params             = (num_params == 1) ? params[0] : params[curr_daemon_index];
+    spec.data_dir           = daemon_data_dir(curr_daemon);
+    spec.offline            = (num_daemons == 1);
+    spec.add_exclusive_nodes(daemons, num_daemons);
+
+    if (spec.params.template_data_dir.len > 0)
+    {
+      if (os_file_exists(spec.data_dir.str)) os_file_dir_delete(spec.data_dir.str);
+      bool cloned = os_file_dir_clone(spec.params.template_data_dir.str, spec.data_dir.str, DAEMON_TEMPLATE_SKIP_FILES, LOKI_ARRAY_COUNT(DAEMON_TEMPLATE_SKIP_FILES));
+      LOKI_ASSERT_MSG(cloned, "Failed to clone template data dir %s into %s", spec.params.template_data_dir.str, spec.data_dir.str);
+    }
+
+    loki_fixed_string<32> name("daemon_%d", curr_daemon->id);
+    itest_launch_args daemon_args   = spec.build();
+    curr_daemon->pid                = launch_process(&daemon_args, name.str, terminal_name, spec.params.keep_terminal_open);
+    itest_cancel_token *cancel_token = itest_async_current_cancel_token();
+    result.push_back(std::async(std::launch::async, [curr_daemon, cancel_token]()
+    {
+      // NOTE: Opening the write end waits until the daemon opens its end of the pipe
+      itest_async_set_cancel_token(cancel_token);
+      curr_daemon->ipc = itest_ipc_setup(global_state.daemon_ipc_name.str, curr_daemon->id);
+      daemon_status(curr_daemon);
+    }));
+  }
+
+  return result;
+}
+
+void start_daemon(daemon_t *daemons, int num_daemons, start_daemon_params *params, int num_params, char const *terminal_name)
+{
+  itest_ready_futures ready = start_daemon_async(daemons, num_daemons, params, num_params, terminal_name);
+  itest_wait_until_ready(&ready);
+}
+
+daemon_t create_and_start_daemon(start_daemon_params params, char const *terminal_name)
+{
+  daemon_t result = create_daemon();
+  start_daemon(&result, 1, &params, 1, terminal_name);
+  return result;
+}
+
+void create_and_start_multi_daemons(daemon_t *daemons, int num_daemons, start_daemon_params *params, int num_params, char const *terminal_name)
+{
+  for (int i = 0; i < num_daemons; ++i)
+    daemons[i] = create_daemon();
+  start_daemon(daemons, num_daemons, params, num_params, terminal_name);
+}
+
+// -------------------------------------------------------------------------------------------------
+//
+// wallet
+//
+// -------------------------------------------------------------------------------------------------
+loki_fixed_string<256> wallet_file_path(wallet_t const *wallet)
+{
+  loki_fixed_string<256> result("%s/wallet_%d", global_state.output_dir.str, wallet->id);
+  return result;
+}
+
+std::future<void> create_and_start_wallet_async(wallet_t *wallet, loki_nettype type, start_wallet_params params, char const *terminal_name)
+{
+  wallet_t &result = *wallet;
+  result           = {};
+  result.id        = global_state.num_wallets++;
+  result.nettype   = type;
+
+  itest_launch_args launch_args = {};
+  launch_args.add("./loki-wallet-cli");
+  if (result.nettype == loki_nettype::testnet)       launch_args.add("--testnet");
+  else if (result.nettype == loki_nettype::fakenet)  launch_args.add("--regtest");
+  else if (result.nettype == loki_nettype::stagenet) launch_args.add("--stagenet");
+
+  loki_fixed_string<256> wallet_path = wallet_file_path(&result);
+  if (params.wallet_file.len > 0)
+  {
+    // NOTE: Copy the wallet so the original can be opened again, the wallet rewrites its file on exit
+    loki_fixed_string<256> src_keys("%s.keys", params.wallet_file.str);
+    loki_fixed_string<256> dest_keys("%s.keys", wallet_path.str);
+    bool copied = os_file_clone(params.wallet_file.str, wallet_path.str) && os_file_clone(src_keys.str, dest_keys.str);
+    LOKI_ASSERT_MSG(copied, "Failed to copy existing wallet %s to %s", params.wallet_file.str, wallet_path.str);
+    launch_args.add("--wallet-file");
+  }
+  else if (params.spend_key.len > 0)
+  {
+    // NOTE: The wallet asks for a restore height after the key, it's a fresh chain so scan from genesis
+    launch_args.add("--restore-height"); launch_args.add("0");
+    launch_args.add("--generate-from-spend-key");
+  }
+  else
+  {
+    launch_args.add("--generate-new-wallet");
+  }
+  launch_args.add("%s", wallet_path.str);
+
+  launch_args.add("--password");            launch_args.add("");
+  launch_args.add("--mnemonic-language");   launch_args.add("English");
+
+  if (params.allow_mismatched_daemon_version)
+    launch_args.add("--allow-mismatched-daemon-version");
+
+  if (params.daemon)
+  {
+    launch_args.add("--daemon-address");
+    launch_args.add("127.0.0.1:%d", params.daemon->rpc_port);
+  }
+
+  launch_args.add("--integration-test-pipe-name");
+  launch_args.add("%s%d", global_state.wallet_ipc_name.str, result.id);
+
+  loki_fixed_string<32> name("wallet_%d", result.id);
+  result.pid                       = launch_process(&launch_args, name.str, terminal_name, params.keep_terminal_open);
+  itest_cancel_token *cancel_token = itest_async_current_cancel_token();
+  return std::async(std::launch::async, [wallet, cancel_token, spend_key = params.spend_key]()
+  {
+    itest_async_set_cancel_token(cancel_token);
+    wallet->ipc = itest_ipc_setup(global_state.wallet_ipc_name.str, wallet->id);
+    if (spend_key.len > 0)
+      itest_read_until_then_write_stdin(&wallet->ipc, LOKI_STRING("Secret spend key"), spend_key.str);
+
+    itest_read_possible_value const possible_values[] =
+    {
+      {LOKI_STRING("Error: refresh failed"), true},
+      {LOKI_STRING("Error: refresh failed: unexpected error: proxy exception in refresh thread"), true},
+      {LOKI_STRING("Balance"),               false},
+    };
+
+    // NOTE: A refresh failure still means the command loop is up, the wallet just started before its
+    // daemon was accepting RPC requests and will refresh on the next command.
+    itest_read_possible_value const *proxy_exception_error = possible_values + 1;
+    itest_read_result read_result = itest_read_stdout_until(&wallet->ipc, possible_values, LOKI_ARRAY_COUNT(possible_values));
+    LOKI_ASSERT_MSG(!str_find(read_result.buf.c_str(), proxy_exception_error->literal.str), "This shows up when you launch the daemon in the incorrect nettype and the wallet tries to forcefully refresh from it");
+  });
+}
+
+wallet_t create_and_start_wallet(loki_nettype type, start_wallet_params params, char const *terminal_name)
+{
+  wallet_t result = {};
+  create_and_start_wallet_async(&result, type, params, terminal_name).get();
+  return result;
+}
+
+// -------------------------------------------------------------------------------------------------
+//
+// loki_integration_tests
+//
+// -------------------------------------------------------------------------------------------------
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <algorithm>
+#include <poll.h>
+#include <sys/prctl.h>
+
+// NOTE: Rough per-process footprint used to pack scenarios onto the machine. Scenarios mostly wait on
+// the daemons so a process doesn't keep a whole core busy, mining bursts are what we're budgeting for.
+float const ITEST_CPUS_PER_DAEMON      = 0.5f;
+float const ITEST_CPUS_PER_WALLET      = 0.25f;
+int   const ITEST_MEMORY_MB_PER_DAEMON = 256;
+int   const ITEST_MEMORY_MB_PER_WALLET = 128;
+int   const ITEST_FDS_PER_PROCESS      = 4; // IPC pipe pair plus the transient fds of fork/exec
+
+struct itest_resource_budget
+{
+  float cpus;
+  int   memory_mb;
+  int   fds;
+
+  bool fits(itest_resource_budget const &cost) const { return cost.cpus <= cpus && cost.memory_mb <= memory_mb && cost.fds <= fds; }
+  void add (itest_resource_budget const &cost)       { cpus += cost.cpus; memory_mb += cost.memory_mb; fds += cost.fds; }
+  void sub (itest_resource_budget const &cost)       { cpus -= cost.cpus; memory_mb -= cost.memory_mb; fds -= cost.fds; }
+};
+
+// NOTE: The most processes a scenario has running at once
+struct itest_resource_cost
+{
+  int daemons;
+  int wallets;
+
+  itest_resource_budget budget() const
+  {
+    itest_resource_budget result = {};
+    result.cpus      = (daemons * ITEST_CPUS_PER_DAEMON) + (wallets * ITEST_CPUS_PER_WALLET);
+    result.memory_mb = (daemons * ITEST_MEMORY_MB_PER_DAEMON) + (wallets * ITEST_MEMORY_MB_PER_WALLET);
+    result.fds       = (daemons + wallets) * ITEST_FDS_PER_PROCESS;
+    return result;
+  }
+};
+
+struct itest_job
+{
+  itest_scenario           *scenario;
+  itest_async_scenario     *async_scenario;
+  char const               *name;
+  itest_resource_cost       cost;
+  int                       timeout_s;
+  float                     expected_duration_s; // From the history of previous runs, -1 if the scenario has never passed
+  bool                      started;
+  int                       attempts;            // Started so far, more than 1 if it was retried
+  bool                      quarantined;         // A chronic flake in the ledger, failing doesn't fail the run
+  bool                      cancelled;           // Failed whilst the run was being stopped, likely not its own fault
+  itest_fixture_scenario   *fixture_scenario;
+  itest_fixture_info const *fixture;
+  bool                      shares_fixture;      // Read-only on its fixture, runs on an instance shared with the rest of its group
+  itest_scenario_context   *context;             // Whilst running, guarded by the work queue's mutex
+  os_cpu_set                cpus;                // Pinned to whilst running, sized from its budget
+  test_result               result;              // Of the last attempt
+};
+
+// NOTE: The budget is what the machine had spare at startup, on a shared runner other jobs eat into it
+// as we go. Admission control samples the load every so often and caps how many scenarios run at once,
+// growing the cap by one whilst there's headroom and halving it when tasks start stalling (AIMD).
+// Pressure stall averages lag by ~10s so we only back off once per window, not on every sample.
+float const ITEST_ADMISSION_CPU_STALL_LIMIT    = 40.f; // % of time some task waited on a CPU
+float const ITEST_ADMISSION_MEMORY_STALL_LIMIT = 10.f; // % of time some task waited on reclaim or swap
+float const ITEST_ADMISSION_IO_STALL_LIMIT     = 40.f; // % of time some task waited on IO
+float const ITEST_ADMISSION_LOAD_PER_CPU_LIMIT = 1.5f; // Used when the kernel has no pressure stall info
+int   const ITEST_ADMISSION_MEMORY_RESERVE_MB  = 512;  // Left free for the page cache and the harness
+int   const ITEST_ADMISSION_SAMPLE_MS          = 1000;
+int   const ITEST_ADMISSION_BACKOFF_MS         = 10000;
+
+struct itest_admission_controller
+{
+  bool                                  enabled;
+  int                                   max_limit;
+  int                                   limit;              // Scenarios allowed to run at once
+  int                                   memory_headroom_mb; // Available at the last sample less what's been started since
+  std::chrono::steady_clock::time_point last_sample;
+  std::chrono::steady_clock::time_point last_backoff;
+};
+
+// NOTE: Workers take the first job in list order that fits in what's left of the budget. If nothing
+// is running then the job is started regardless, a scenario bigger than the machine still has to run.
+struct work_queue
+{
+  std::mutex                 mutex;
+  std::condition_variable    job_finished;
+  std::vector<itest_job>     jobs;
+  size_t                     num_jobs_started;
+  int                        num_jobs_running;
+  itest_resource_budget      available;
+  std::atomic<size_t>        num_jobs_succeeded;
+  int                        max_retries;        // Failed jobs are requeued until they've been retried this many times
+  itest_admission_controller admission;
+  bool                       fail_fast;          // Stop the run on the first failure
+  std::atomic<bool>          stopping;           // Nothing more is started, running jobs are being cancelled
+  loki_fixed_string<256>     stop_reason;
+
+  int                        num_jobs_waiting_on_fixture; // Claimed by a fixture group and counted as running, but not yet run
+
+  int                        first_scenario_cpu;
+  std::vector<float>         cpu_load;           // Budgeted CPUs of the running scenarios pinned to each scenario CPU, empty when not pinning
+
+  void add(itest_scenario_info const *info)
+  {
+    bool const shares_fixture = info->fixture && info->fixture_use == itest_fixture_use::read_only;
+    jobs.push_back({info->scenario, info->async_scenario, info->name, {info->daemons, info->wallets}, info->timeout_s, -1.f, false, 0, false, false, info->fixture_scenario, info->fixture, shares_fixture, nullptr, {}, {}});
+  }
+};
+
+FILE_SCOPE work_queue global_work_queue;
+
+// NOTE: Call with the work queue locked
+FILE_SCOPE bool work_queue_drained()
+{
+  bool const all_started = global_work_queue.num_jobs_started == global_work_queue.jobs.size() || global_work_queue.stopping;
+  bool result            = all_started && global_work_queue.num_jobs_running == 0;
+  return result;
+}
+
+// NOTE: Call with the work queue locked. Running scenarios are cancelled here, the watchdog (or the
+// isolated workers' parent) kills their processes so everything is torn down within a second or so.
+FILE_SCOPE void stop_work_queue(char const *reason)
+{
+  if (global_work_queue.stopping) return;
+  global_work_queue.stopping    = true;
+  global_work_queue.stop_reason = loki_fixed_string<256>("%s", reason);
+  fprintf(stderr, "\nStopping the run (%s), cancelling %d running scenario(s)\n\n", reason, global_work_queue.num_jobs_running);
+
+  for (itest_job &job : global_work_queue.jobs)
+  {
+    if (job.context)
+      itest_cancel(job.context);
+  }
+  global_work_queue.job_finished.notify_all();
+}
+
+FILE_SCOPE test_result cancelled_result(itest_job const *job, itest_scenario_context *context)
+{
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - context->start_time).count();
+  std::lock_guard<std::mutex> lock(context->pids_mutex);
+
+  test_result result = {};
+  result.name        = loki_fixed_string<512>("%s", job->name);
+  result.failed      = true;
+  result.timed_out   = context->timed_out;
+  result.duration_ms = duration / 1000.f;
+  if (result.timed_out)
+    result.fail_msg = loki_fixed_string<>("Timed out after %ds, last command in flight: %s", job->timeout_s, context->last_cmd.len ? context->last_cmd.str : "(none)");
+  else
+    result.fail_msg = loki_fixed_string<>("Cancelled, %s. Last command in flight: %s", global_work_queue.stop_reason.str, context->last_cmd.len ? context->last_cmd.str : "(none)");
+  return result;
+}
+
+FILE_SCOPE itest_task<test_result> run_async_scenario(itest_job const *job, itest_scenario_context *context)
+{
+  test_result result = {};
+  bool cancelled     = false;
+  try
+  {
+    result = co_await job->async_scenario();
+  }
+  catch (itest_cancelled const &)
+  {
+    cancelled = true;
+  }
+
+  if (cancelled)
+  {
+    result = cancelled_result(job, context);
+  }
+  else
+  {
+    auto duration      = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - context->start_time).count();
+    result.duration_ms = duration / 1000.f;
+  }
+  co_return result;
+}
+
+FILE_SCOPE itest_scenario_context *new_scenario_context(itest_job const *job)
+{
+  auto *result       = new itest_scenario_context();
+  result->start_time = std::chrono::steady_clock::now();
+  result->deadline   = result->start_time + std::chrono::seconds(job->timeout_s);
+  result->cpus       = job->cpus;
+  return result;
+}
+
+FILE_SCOPE test_result fixture_setup_failed_result(itest_job const *job)
+{
+  test_result result = {};
+  result.name        = loki_fixed_string<512>("%s", job->name);
+  result.failed      = true;
+  result.fail_msg    = loki_fixed_string<>("Fixture %s failed to set up", job->fixture->name);
+  return result;
+}
+
+FILE_SCOPE test_result run_private_fixture_scenario(itest_job const *job)
+{
+  helper_blockchain_environment environment = {};
+  LOKI_DEFER { helper_cleanup_blockchain_environment(&environment); };
+
+  test_result setup_context = {};
+  setup_context.name        = loki_fixed_string<512>("%s", job->name);
+  if (!job->fixture->setup(&environment, &setup_context))
+    return fixture_setup_failed_result(job);
+
+  test_result result = job->fixture_scenario(&environment);
+  return result;
+}
+
+// NOTE: Blocks until the scenario finishes or is timed out, coroutine scenarios are waited on
+FILE_SCOPE test_result run_scenario(itest_job const *job, itest_scenario_context *context)
+{
+  test_result result = {};
+  itest_async_set_cancel_token(context);
+  try
+  {
+    if (job->async_scenario)        result = itest_sync_wait(run_async_scenario(job, context));
+    else if (job->fixture_scenario) result = run_private_fixture_scenario(job);
+    else                            result = job->scenario();
+  }
+  catch (itest_cancelled const &)
+  {
+    result = cancelled_result(job, context);
+  }
+  itest_async_set_cancel_token(nullptr);
+
+  if (job->fixture_scenario)
+  {
+    // NOTE: Include the fixture's setup, the history schedules by the whole time the scenario takes
+    auto duration      = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - context->start_time).count();
+    result.duration_ms = duration / 1000.f;
+  }
+  return result;
+}
+
+// NOTE: Call with the work queue locked
+FILE_SCOPE void sample_admission_pressure()
+{
+  itest_admission_controller *admission = &global_work_queue.admission;
+  auto const now                        = std::chrono::steady_clock::now();
+  if (!admission->enabled || now - admission->last_sample < std::chrono::milliseconds(ITEST_ADMISSION_SAMPLE_MS))
+    return;
+  admission->last_sample = now;
+
+  float const cpu_stall    = os_pressure_stall("cpu");
+  float const memory_stall = os_pressure_stall("memory");
+  float const io_stall     = os_pressure_stall("io");
+  float const load         = os_load_average();
+  int const memory_mb      = os_memory_available_mb();
+  admission->memory_headroom_mb = (memory_mb == -1) ? INT32_MAX : memory_mb - ITEST_ADMISSION_MEMORY_RESERVE_MB;
+
+  bool pressured = false;
+  if (cpu_stall == -1.f)
+    pressured |= (load != -1.f && load > os_num_cpus() * ITEST_ADMISSION_LOAD_PER_CPU_LIMIT);
+  else
+    pressured |= (cpu_stall > ITEST_ADMISSION_CPU_STALL_LIMIT);
+  pressured |= (memory_stall > ITEST_ADMISSION_MEMORY_STALL_LIMIT);
+  pressured |= (io_stall     > ITEST_ADMISSION_IO_STALL_LIMIT);
+  pressured |= (admission->memory_headroom_mb < 0);
+
+  if (pressured)
+  {
+    if (now - admission->last_backoff < std::chrono::milliseconds(ITEST_ADMISSION_BACKOFF_MS) || admission->limit == 1)
+      return;
+
+    admission->last_backoff = now;
+    admission->limit        = LOKI_MAX(admission->limit / 2, 1);
+    printf("Backing off to %d concurrent scenario(s): load %.2f, stalled cpu %.1f%% memory %.1f%% io %.1f%%, %dMB available\n",
+           admission->limit, load, cpu_stall, memory_stall, io_stall, memory_mb);
+  }
+  else if (global_work_queue.num_jobs_running >= admission->limit)
+  {
+    admission->limit = LOKI_MIN(admission->limit + 1, admission->max_limit);
+  }
+}
+
+// NOTE: Call with the work queue locked
+FILE_SCOPE bool admission_allows(itest_resource_budget const &cost)
+{
+  itest_admission_controller const *admission = &global_work_queue.admission;
+  int const num_running                       = global_work_queue.num_jobs_running - global_work_queue.num_jobs_waiting_on_fixture;
+  bool result = !admission->enabled || (num_running < admission->limit && cost.memory_mb <= admission->memory_headroom_mb);
+  return result;
+}
+
+// NOTE: Call with the work queue locked. Retries are scheduled in the tail, they only get started when
+// none of the first attempts fit.
+FILE_SCOPE itest_job *next_job_that_fits()
+{
+  itest_job *result = nullptr;
+  if (global_work_queue.stopping)
+    return result;
+
+  sample_admission_pressure();
+  for (int retries = 0; retries < 2 && !result; retries++)
+  {
+    for (itest_job &check : global_work_queue.jobs)
+    {
+      if (check.started || (check.attempts > 0) != (retries == 1)) continue;
+      itest_resource_budget const cost = check.cost.budget();
+      if (global_work_queue.num_jobs_running == 0 || (global_work_queue.available.fits(cost) && admission_allows(cost)))
+      {
+        result = &check;
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+// NOTE: Call with the work queue locked. Pins the scenario to as many CPUs as it was budgeted, rounded
+// up, so a scenario with many daemons isn't squeezed onto a slice sized for one. The least loaded run
+// of CPUs is picked so the running scenarios spread out instead of sharing the same cores.
+FILE_SCOPE os_cpu_set claim_scenario_cpus(itest_resource_budget const &cost)
+{
+  os_cpu_set result        = {};
+  std::vector<float> *load = &global_work_queue.cpu_load;
+  int const num_cpus       = static_cast<int>(load->size());
+  if (num_cpus == 0)
+    return result;
+
+  int const count = LOKI_MIN(LOKI_MAX(static_cast<int>(std::ceil(cost.cpus)), 1), num_cpus);
+  int best_first  = 0;
+  float best_load = -1.f;
+  for (int first = 0; first + count <= num_cpus; first++)
+  {
+    float run_load = 0.f;
+    for (int i = 0; i < count; i++) run_load += (*load)[first + i];
+    if (best_load < 0.f || run_load < best_load)
+    {
+      best_first = first;
+      best_load  = run_load;
+    }
+  }
+
+  for (int i = 0; i < count; i++) (*load)[best_first + i] += cost.cpus / count;
+  result.first = global_work_queue.first_scenario_cpu + best_first;
+  result.count = count;
+  return result;
+}
+
+// NOTE: Call with the work queue locked
+FILE_SCOPE void release_scenario_cpus(os_cpu_set cpus, itest_resource_budget const &cost)
+{
+  std::vector<float> *load = &global_work_queue.cpu_load;
+  if (load->empty() || cpus.count == 0)
+    return;
+
+  for (int i = 0; i < cpus.count; i++)
+  {
+    float *cpu_load = &(*load)[cpus.first - global_work_queue.first_scenario_cpu + i];
+    *cpu_load       = LOKI_MAX(*cpu_load - (cost.cpus / cpus.count), 0.f);
+  }
+}
+
+// NOTE: Call with the work queue locked
+FILE_SCOPE void start_job(itest_job *job)
+{
+  job->started = true;
+  job->attempts++;
+  job->cpus = claim_scenario_cpus(job->cost.budget());
+  global_work_queue.num_jobs_started++;
+  global_work_queue.num_jobs_running++;
+  global_work_queue.available.sub(job->cost.budget());
+  global_work_queue.admission.memory_headroom_mb -= job->cost.budget().memory_mb;
+}
+
+// NOTE: Call with the work queue locked. Claims the read-only scenarios on the leader's fixture that
+// haven't started, they're run on the leader's instance of the fixture and CPUs. Only the leader takes
+// from the budget, the group never has more than one scenario running.
+FILE_SCOPE std::vector<itest_job *> claim_fixture_group(itest_job *leader)
+{
+  std::vector<itest_job *> result = {leader};
+  for (itest_job &job : global_work_queue.jobs)
+  {
+    if (job.started || !job.shares_fixture || job.fixture != leader->fixture) continue;
+    job.started = true;
+    job.attempts++;
+    job.cpus    = leader->cpus;
+    global_work_queue.num_jobs_started++;
+    global_work_queue.num_jobs_running++;
+    global_work_queue.num_jobs_waiting_on_fixture++;
+    result.push_back(&job);
+  }
+  return result;
+}
+
+FILE_SCOPE void finish_job(itest_job *job, itest_resource_budget const &cost, test_result const &result)
+{
+  print_test_results(&result);
+  bool const retry = result.failed && job->attempts <= global_work_queue.max_retries && !global_work_queue.stopping;
+  if (retry)
+    fprintf(stdout, "  Retrying %s, attempt %d of %d\n\n", job->name, job->attempts + 1, global_work_queue.max_retries + 1);
+  else if (result.failed && job->quarantined)
+    fprintf(stdout, "  %s is quarantined as a chronic flake, not failing the run\n\n", job->name);
+
+  std::lock_guard<std::mutex> lock(global_work_queue.mutex);
+  job->result    = result;
+  job->context   = nullptr;
+  job->cancelled = result.failed && global_work_queue.stopping;
+  if (retry)
+  {
+    job->started = false;
+    global_work_queue.num_jobs_started--;
+  }
+  else if (!result.failed)
+  {
+    global_work_queue.num_jobs_succeeded++;
+  }
+
+  global_work_queue.num_jobs_running--;
+  global_work_queue.available.add(cost);
+  release_scenario_cpus(job->cpus, cost);
+  global_work_queue.job_finished.notify_all();
+
+  if (global_work_queue.fail_fast && result.failed && !retry && !job->quarantined)
+    stop_work_queue(loki_fixed_string<256>("fail fast after %s failed", job->name).str);
+}
+
+// NOTE: Runs a fixture group one scenario after the other on a single instance of the fixture. Each
+// scenario still gets its own context and deadline, and the fixture's processes are added to it so a
+// wedged scenario takes the fixture down with it. The fixture is then set up again for the rest of the
+// group. The setup counts against the first scenario's deadline.
+FILE_SCOPE void run_fixture_group(std::vector<itest_job *> const &group, itest_resource_budget const &cost)
+{
+  itest_fixture_info const *fixture         = group[0]->fixture;
+  helper_blockchain_environment environment = {};
+  bool fixture_ready                        = false;
+  bool fixture_failed                       = false; // NOTE: Not set up again, every scenario left fails the same way
+
+  for (size_t index = 0; index < group.size(); index++)
+  {
+    itest_job *job                  = group[index];
+    itest_scenario_context *context = new_scenario_context(job);
+    bool stopping                   = false;
+    {
+      std::lock_guard<std::mutex> lock(global_work_queue.mutex);
+      job->context = context;
+      stopping     = global_work_queue.stopping;
+      if (index > 0) global_work_queue.num_jobs_waiting_on_fixture--;
+    }
+
+    test_result result = {};
+    bool cancelled     = stopping;
+    itest_async_set_cancel_token(context);
+    try
+    {
+      if (stopping)
+      {
+        result = cancelled_result(job, context);
+      }
+      else if (fixture_failed)
+      {
+        result = fixture_setup_failed_result(job);
+      }
+      else
+      {
+        if (fixture_ready)
+        {
+          std::lock_guard<std::mutex> lock(context->pids_mutex);
+          for (daemon_t const &daemon : environment.all_daemons) context->pids.push_back(daemon.pid);
+          for (wallet_t const &wallet : environment.wallets)     context->pids.push_back(wallet.pid);
+        }
+        else
+        {
+          test_result setup_context = {};
+          setup_context.name        = loki_fixed_string<512>("%s", fixture->name);
+          fixture_ready             = fixture->setup(&environment, &setup_context);
+          fixture_failed            = !fixture_ready;
+        }
+
+        result = fixture_ready ? job->fixture_scenario(&environment) : fixture_setup_failed_result(job);
+      }
+    }
+    catch (itest_cancelled const &)
+    {
+      result    = cancelled_result(job, context);
+      cancelled = true;
+    }
+    itest_async_set_cancel_token(nullptr);
+
+    if ((cancelled || fixture_failed) && environment.all_daemons.size())
+    {
+      helper_cleanup_blockchain_environment(&environment);
+      environment   = {};
+      fixture_ready = false;
+    }
+
+    auto duration      = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - context->start_time).count();
+    result.duration_ms = duration / 1000.f;
+    finish_job(job, (index + 1 == group.size()) ? cost : itest_resource_budget{}, result);
+    delete context;
+  }
+
+  if (fixture_ready)
+    helper_cleanup_blockchain_environment(&environment);
+}
+
+void thread_to_task_dispatcher(os_cpu_set harness_cpus)
+{
+  os_set_thread_affinity(harness_cpus);
+
+  // NOTE: Keep going whilst anything is running, a failure can requeue its job for a retry and
+  // coroutine scenarios finish on the event loops
+  std::unique_lock<std::mutex> lock(global_work_queue.mutex);
+  while (!work_queue_drained())
+  {
+    itest_job *job = next_job_that_fits();
+    if (!job)
+    {
+      // NOTE: Wake up to resample, admission can open up without anything finishing
+      global_work_queue.job_finished.wait_for(lock, std::chrono::milliseconds(ITEST_ADMISSION_SAMPLE_MS));
+      continue;
+    }
+
+    start_job(job);
+    itest_resource_budget const cost = job->cost.budget();
+    if (job->shares_fixture)
+    {
+      std::vector<itest_job *> group = claim_fixture_group(job);
+      lock.unlock();
+      run_fixture_group(group, cost);
+      lock.lock();
+      continue;
+    }
+
+    itest_scenario_context *context  = new_scenario_context(job);
+    job->context                     = context;
+    lock.unlock();
+
+    if (job->async_scenario)
+    {
+      // NOTE: Don't hold the worker whilst the coroutine waits on its processes, it goes back to
+      // dequeuing and the coroutine returns its budget from the event loop once it finishes.
+      itest_async_spawn(run_async_scenario(job, context), [job, cost, context](test_result result) {
+        finish_job(job, cost, result);
+        delete context;
+      }, context);
+    }
+    else
+    {
+      test_result result = run_scenario(job, context);
+      finish_job(job, cost, result);
+      delete context;
+    }
+
+    lock.lock();
+  }
+}
+
+// NOTE: Scenarios only notice cancellation when they wait on something, so past the deadline or once
+// the run is stopping the processes are killed as well. Anything still blocked on them fails fast
+// instead of hanging. SIGINT is noticed here too and stops the run the same way.
+void thread_to_watchdog(os_cpu_set harness_cpus)
+{
+  os_set_thread_affinity(harness_cpus);
+
+  std::unique_lock<std::mutex> lock(global_work_queue.mutex);
+  for (;;)
+  {
+    if (os_interrupted())
+      stop_work_queue("interrupted");
+
+    if (work_queue_drained())
+      break;
+
+    std::vector<int> pids_to_reap;
+    auto const now = std::chrono::steady_clock::now();
+    for (itest_job &job : global_work_queue.jobs)
+    {
+      itest_scenario_context *context = job.context;
+      if (!context || context->processes_killed) continue;
+
+      bool const expired = now >= context->deadline;
+      if (!expired && !global_work_queue.stopping) continue;
+
+      if (expired)
+      {
+        fprintf(stderr, "%s: Exceeded its deadline of %ds, cancelling it and killing its processes\n", job.name, job.timeout_s);
+        context->timed_out = true;
+      }
+      context->processes_killed = true;
+      itest_cancel(context);
+
+      std::lock_guard<std::mutex> context_lock(context->pids_mutex);
+      for (int pid : context->pids)
+      {
+        itest_kill_process(pid);
+        pids_to_reap.push_back(pid);
+      }
+    }
+
+    if (pids_to_reap.size())
+    {
+      lock.unlock();
+      for (int pid : pids_to_reap)
+        os_wait_for_process_exit(pid, 1000 /*timeout_ms*/);
+      lock.lock();
+    }
+
+    global_work_queue.job_finished.wait_for(lock, std::chrono::seconds(1));
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+//
+// scenario history
+//
+// -------------------------------------------------------------------------------------------------
+// NOTE: Durations of scenarios that passed in previous runs, one line per scenario of
+// <name> <duration_s> <daemons> <wallets>. Used to start the longest scenarios first so a long
+// scenario isn't dequeued last and left running whilst every other thread sits idle.
+char const ITEST_HISTORY_FILE[] = "./itest_history.txt";
+struct itest_history_entry
+{
+  float duration_s;
+  int   daemons;
+  int   wallets;
+};
+typedef std::unordered_map<std::string, itest_history_entry> itest_history;
+
+FILE_SCOPE itest_history load_history(char const *path)
+{
+  itest_history result;
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return result;
+
+  char name[512];
+  itest_history_entry entry = {};
+  while (fscanf(file, "%511s %f %d %d", name, &entry.duration_s, &entry.daemons, &entry.wallets) == 4)
+    result[name] = entry;
+
+  fclose(file);
+  return result;
+}
+
+FILE_SCOPE bool save_history(char const *path, itest_history const &history)
+{
+  std::string buf;
+  for (auto const &it : history)
+  {
+    itest_history_entry const &entry = it.second;
+    buf += loki_fixed_string<1024>("%s %.2f %d %d\n", it.first.c_str(), entry.duration_s, entry.daemons, entry.wallets).str;
+  }
+
+  bool result = os_write_file(path, buf.c_str(), static_cast<int>(buf.size()));
+  return result;
+}
+
+// NOTE: Longest processing time first. Scenarios without a history go to the front, we don't know
+// how long they take and they might be the longest.
+FILE_SCOPE void order_longest_expected_first(std::vector<itest_job> *jobs, itest_history const &history)
+{
+  for (itest_job &job : *jobs)
+  {
+    auto it = history.find(job.name);
+    job.expected_duration_s = (it == history.end()) ? -1.f : it->second.duration_s;
+  }
+
+  std::stable_sort(jobs->begin(), jobs->end(), [](itest_job const &a, itest_job const &b) {
+    if (a.expected_duration_s < 0 || b.expected_duration_s < 0) return a.expected_duration_s < 0 && b.expected_duration_s >= 0;
+    return a.expected_duration_s > b.expected_duration_s;
+  });
+}
+
+// NOTE: Smooth the measurements, a single slow run on a loaded machine shouldn't reorder the queue
+FILE_SCOPE void update_history(itest_history *history, std::vector<itest_job> const &jobs)
+{
+  for (itest_job const &job : jobs)
+  {
+    if (!job.started || job.result.failed) continue;
+    itest_history_entry &entry = (*history)[job.name];
+    entry.duration_s           = (job.expected_duration_s < 0) ? job.result.duration_ms : (entry.duration_s + job.result.duration_ms) * 0.5f;
+    entry.daemons              = job.cost.daemons;
+    entry.wallets              = job.cost.wallets;
+  }
+}
+
+// NOTE: Scenarios are independent so the run can't finish faster than its longest scenario (the
+// critical path) or the total scenario time spread evenly over every thread, whichever is larger.
+FILE_SCOPE void print_parallel_efficiency(std::vector<itest_job> const &jobs, int num_threads, float wall_time_s)
+{
+  float total_s            = 0;
+  itest_job const *longest = nullptr;
+  for (itest_job const &job : jobs)
+  {
+    if (!job.started) continue;
+    total_s += job.result.duration_ms;
+    if (!longest || job.result.duration_ms > longest->result.duration_ms) longest = &job;
+  }
+
+  if (!longest || wall_time_s <= 0)
+    return;
+
+  float const critical_path_s = longest->result.duration_ms;
+  float const lower_bound_s   = LOKI_MAX(critical_path_s, total_s / num_threads);
+  printf("Scenario time %5.2fs, critical path %5.2fs (%s)\n", total_s, critical_path_s, longest->name);
+  printf("Parallel efficiency %5.1f%% of the lower bound %5.2fs, thread utilisation %5.1f%%\n\n",
+         100.f * lower_bound_s / wall_time_s,
+         lower_bound_s,
+         100.f * total_s / (wall_time_s * num_threads));
+}
+
+// -------------------------------------------------------------------------------------------------
+//
+// flake ledger
+//
+// -------------------------------------------------------------------------------------------------
+// NOTE: Outcomes of each scenario over its recent runs, one line per scenario of <name> <outcomes>
+// oldest first. P passed on the first attempt, F failed and then passed on a retry, X failed every
+// attempt. Scenarios that flake often enough are quarantined, they still run but don't fail the run.
+char const ITEST_FLAKE_LEDGER_FILE[]     = "./itest_flakes.txt";
+int  const ITEST_FLAKE_LEDGER_RUNS       = 20; // Outcomes kept per scenario
+int  const ITEST_QUARANTINE_WINDOW       = 10; // Most recent outcomes considered for quarantine
+int  const ITEST_QUARANTINE_MIN_FAILURES = 3;  // Flaky or failed runs in the window to be quarantined
+typedef std::unordered_map<std::string, std::string> itest_flake_ledger;
+
+FILE_SCOPE itest_flake_ledger load_flake_ledger(char const *path)
+{
+  itest_flake_ledger result;
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return result;
+
+  char name[512];
+  char outcomes[128];
+  while (fscanf(file, "%511s %127s", name, outcomes) == 2)
+    result[name] = outcomes;
+
+  fclose(file);
+  return result;
+}
+
+FILE_SCOPE bool save_flake_ledger(char const *path, itest_flake_ledger const &ledger)
+{
+  std::string buf;
+  for (auto const &it : ledger)
+    buf += loki_fixed_string<1024>("%s %s\n", it.first.c_str(), it.second.c_str()).str;
+
+  bool result = os_write_file(path, buf.c_str(), static_cast<int>(buf.size()));
+  return result;
+}
+
+// NOTE: A scenario that never passes is broken rather than flaky and keeps failing the run
+FILE_SCOPE bool is_chronic_flake(std::string const &outcomes)
+{
+  size_t const window_start = outcomes.size() - LOKI_MIN(outcomes.size(), static_cast<size_t>(ITEST_QUARANTINE_WINDOW));
+  int  num_failures         = 0;
+  bool passes               = false;
+  for (size_t i = window_start; i < outcomes.size(); i++)
+  {
+    num_failures += (outcomes[i] != 'P');
+    passes       |= (outcomes[i] != 'X');
+  }
+
+  bool result = passes && num_failures >= ITEST_QUARANTINE_MIN_FAILURES;
+  return result;
+}
+
+FILE_SCOPE void quarantine_chronic_flakes(std::vector<itest_job> *jobs, itest_flake_ledger const &ledger)
+{
+  for (itest_job &job : *jobs)
+  {
+    auto it         = ledger.find(job.name);
+    job.quarantined = (it != ledger.end()) && is_chronic_flake(it->second);
+    if (job.quarantined)
+      printf("Quarantined %s, flaky in its recent runs: %s\n", job.name, it->second.c_str());
+  }
+}
+
+FILE_SCOPE void update_flake_ledger(itest_flake_ledger *ledger, std::vector<itest_job> const &jobs)
+{
+  for (itest_job const &job : jobs)
+  {
+    if (!job.started || job.cancelled) continue;
+    std::string &outcomes = (*ledger)[job.name];
+    outcomes += job.result.failed ? 'X' : (job.attempts > 1) ? 'F' : 'P';
+    if (outcomes.size() > ITEST_FLAKE_LEDGER_RUNS)
+      outcomes.erase(0, outcomes.size() - ITEST_FLAKE_LEDGER_RUNS);
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+//
+// sharding
+//
+// -------------------------------------------------------------------------------------------------
+float const ITEST_DEFAULT_SCENARIO_DURATION_S = 60.f; // NOTE: Used when no scenario has a history yet
+
+// NOTE: Deterministically keep only this shard's jobs. Every shard computes the same assignment given
+// the same registry, filters and shard history: jobs are dealt out longest first to whichever shard has
+// the least expected time so far. Scenarios without a history count as the average scenario. The
+// history must be a snapshot every shard is given, not ./itest_history.txt, which differs between
+// machines and is rewritten by each shard as it finishes.
+FILE_SCOPE void keep_shard_jobs(std::vector<itest_job> *jobs, int shard_index, int shard_count, itest_history const &shard_history)
+{
+  if (shard_count <= 1)
+    return;
+
+  std::vector<std::pair<itest_job const *, float>> sorted; // NOTE: The job and its duration in the snapshot, -1 if unknown
+  float known_total_s = 0;
+  int   num_known     = 0;
+  for (itest_job const &job : *jobs)
+  {
+    auto it                = shard_history.find(job.name);
+    float const duration_s = (it == shard_history.end()) ? -1.f : it->second.duration_s;
+    sorted.push_back({&job, duration_s});
+    if (duration_s < 0) continue;
+    known_total_s += duration_s;
+    num_known++;
+  }
+  float const unknown_duration_s = num_known ? known_total_s / num_known : ITEST_DEFAULT_SCENARIO_DURATION_S;
+
+  for (auto &it : sorted)
+    if (it.second < 0) it.second = unknown_duration_s;
+
+  std::sort(sorted.begin(), sorted.end(), [](std::pair<itest_job const *, float> const &a, std::pair<itest_job const *, float> const &b) {
+    if (a.second != b.second) return a.second > b.second;
+    return strcmp(a.first->name, b.first->name) < 0;
+  });
+
+  std::vector<float>        shard_load_s(shard_count, 0.f);
+  std::vector<char const *> keep;
+  for (auto const &it : sorted)
+  {
+    int const shard     = static_cast<int>(std::min_element(shard_load_s.begin(), shard_load_s.end()) - shard_load_s.begin());
+    shard_load_s[shard] += it.second;
+    if (shard == shard_index) keep.push_back(it.first->name);
+  }
+
+  jobs->erase(std::remove_if(jobs->begin(), jobs->end(), [&keep](itest_job const &job) {
+                return std::find(keep.begin(), keep.end(), job.name) == keep.end();
+              }),
+              jobs->end());
+}
+
+// NOTE: One line per scenario of <name>\t<OK|FAILED>\t<duration_s>\t<fail message>, shards each write
+// one and --merge-results combines them into a single report.
+FILE_SCOPE bool write_results_file(char const *path, std::vector<itest_job> const &jobs)
+{
+  std::string buf;
+  for (itest_job const &job : jobs)
+  {
+    if (!job.started) continue;
+    std::string fail_msg = job.result.fail_msg.str;
+    for (char &ch : fail_msg)
+      if (ch == '\t' || ch == '\n' || ch == '\r') ch = ' ';
+
+    char const *status = !job.result.failed   ? "OK"
+                       : job.cancelled        ? "CANCELLED"
+                       : job.quarantined      ? "QUARANTINED"
+                       : job.result.timed_out ? "TIMEOUT"
+                                              : "FAILED";
+    float const duration_s = job.result.duration_ms; // NOTE: test_result::duration_ms is measured in seconds
+    buf += loki_fixed_string<1024>("%s\t%s\t%.2f\t", job.name, status, duration_s).str;
+    buf += fail_msg;
+    buf += '\n';
+  }
+
+  bool result = os_write_file(path, buf.c_str(), static_cast<int>(buf.size()));
+  return result;
+}
+
+struct itest_run_options
+{
+  bool                      pin_cpus      = true;
+  int                       harness_cpus  = 0;
+  bool                      fixture_cache = true;
+  bool                      list;
+  std::vector<char const *> filters;      // Run scenarios whose name contains any of these
+  std::vector<char const *> tags;         // Run scenarios with any of these tags
+  int                       shard_index;  // 0 based, the command line is 1 based
+  int                       shard_count   = 1;
+  char const               *results_file;
+  char const               *shard_history; // Read-only durations every shard balances against
+  bool                      isolate;      // Run each scenario in a forked worker process
+  int                       retries;      // Times a failed scenario is rerun before it counts as a failure
+  bool                      quarantine    = true;
+  bool                      admission     = true;
+  bool                      fail_fast;    // Stop the run and cancel everything on the first failure
+  bool                      share_fixture = true;
+  bool                      deterministic_wallets;
+  uint64_t                  wallet_seed;
+};
+
+template <size_t N>
+FILE_SCOPE bool arg_match(char const *arg, char const (&expected)[N])
+{
+  bool result = (strlen(arg) == N - 1 && strncmp(arg, expected, N - 1) == 0);
+  return result;
+}
+
+// NOTE: Shared by the run and generate modes so the same seed gives the same wallets in both
+FILE_SCOPE bool parse_wallet_seed(char const *arg, char const *arg_val_str, uint64_t *seed)
+{
+  char *end = nullptr;
+  *seed     = strtoull(arg_val_str, &end, 10);
+  if (end == arg_val_str || *end != 0 || arg_val_str[0] == '-')
+  {
+    fprintf(stderr, "Argument %s has invalid value %s\n", arg, arg_val_str);
+    return false;
+  }
+  return true;
+}
+
+FILE_SCOPE bool parse_run_options(int argc, char **argv, itest_run_options *options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    char const *arg           = argv[i];
+    char const NO_PIN_ARG[]   = "--no-cpu-pinning";
+    char const HARNESS_CPUS[] = "--harness-cpus";
+    char const NO_CACHE_ARG[] = "--no-fixture-cache";
+    char const LIST_ARG[]     = "--list";
+    char const FILTER_ARG[]   = "--filter";
+    char const TAG_ARG[]      = "--tag";
+    char const SHARD_ARG[]    = "--shard";
+    char const RESULTS_ARG[]  = "--results-file";
+    char const HISTORY_ARG[]  = "--shard-history";
+    char const ISOLATE_ARG[]  = "--isolate";
+    char const RETRIES_ARG[]  = "--retries";
+    char const NO_QUAR_ARG[]  = "--no-quarantine";
+    char const NO_ADMIT_ARG[] = "--no-admission-control";
+    char const FAILFAST_ARG[] = "--fail-fast";
+    char const NO_SHARE_ARG[] = "--no-shared-fixtures";
+    char const SEED_ARG[]     = "--wallet-seed";
+
+    if (arg_match(arg, NO_PIN_ARG))
+    {
+      options->pin_cpus = false;
+      continue;
+    }
+
+    if (arg_match(arg, NO_CACHE_ARG))
+    {
+      options->fixture_cache = false;
+      continue;
+    }
+
+    if (arg_match(arg, LIST_ARG))
+    {
+      options->list = true;
+      continue;
+    }
+
+    if (arg_match(arg, ISOLATE_ARG))
+    {
+      options->isolate = true;
+      continue;
+    }
+
+    if (arg_match(arg, NO_QUAR_ARG))
+    {
+      options->quarantine = false;
+      continue;
+    }
+
+    if (arg_match(arg, NO_ADMIT_ARG))
+    {
+      options->admission = false;
+      continue;
+    }
+
+    if (arg_match(arg, FAILFAST_ARG))
+    {
+      options->fail_fast = true;
+      continue;
+    }
+
+    if (arg_match(arg, NO_SHARE_ARG))
+    {
+      options->share_fixture = false;
+      continue;
+    }
+
+    char const *arg_val_str = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (arg_match(arg, FILTER_ARG) && arg_val_str)
+    {
+      options->filters.push_back(arg_val_str);
+      i++;
+      continue;
+    }
+
+    if (arg_match(arg, TAG_ARG) && arg_val_str)
+    {
+      options->tags.push_back(arg_val_str);
+      i++;
+      continue;
+    }
+
+    if (arg_match(arg, SHARD_ARG) && arg_val_str)
+    {
+      int shard = 0, count = 0;
+      if (sscanf(arg_val_str, "%d/%d", &shard, &count) != 2 || count < 1 || shard < 1 || shard > count)
+      {
+        fprintf(stderr, "Argument %s has invalid value %s, expected <shard>/<count> i.e. 1/4\n", arg, arg_val_str);
+        return false;
+      }
+
+      if (count > ITEST_MAX_COLOCATED_SHARDS)
+      {
+        fprintf(stderr, "Argument %s has invalid value %s, at most %d shards fit in the port ranges\n", arg, arg_val_str, ITEST_MAX_COLOCATED_SHARDS);
+        return false;
+      }
+
+      options->shard_index = shard - 1;
+      options->shard_count = count;
+      i++;
+      continue;
+    }
+
+    if (arg_match(arg, RESULTS_ARG) && arg_val_str)
+    {
+      options->results_file = arg_val_str;
+      i++;
+      continue;
+    }
+
+    if (arg_match(arg, HISTORY_ARG) && arg_val_str)
+    {
+      options->shard_history = arg_val_str;
+      i++;
+      continue;
+    }
+
+    if (arg_match(arg, RETRIES_ARG) && arg_val_str)
+    {
+      options->retries = atoi(arg_val_str);
+      if (options->retries < 0)
+      {
+        fprintf(stderr, "Argument %s has invalid value %s\n", arg, arg_val_str);
+        return false;
+      }
+      i++;
+      continue;
+    }
+
+    if (arg_match(arg, SEED_ARG) && arg_val_str)
+    {
+      if (!parse_wallet_seed(arg, arg_val_str, &options->wallet_seed))
+        return false;
+      options->deterministic_wallets = true;
+      i++;
+      continue;
+    }
+
+    if (arg_match(arg, HARNESS_CPUS) && arg_val_str)
+    {
+      options->harness_cpus = atoi(arg_val_str);
+      if (options->harness_cpus < 0)
+      {
+        fprintf(stderr, "Argument %s has invalid value %s\n", arg, arg_val_str);
+        return false;
+      }
+      i++;
+      continue;
+    }
+
+    fprintf(stderr, "Unrecognised argument %s\n\n", arg);
+    return false;
+  }
+
+  return true;
+}
+
+FILE_SCOPE bool scenario_selected(itest_scenario_info const *info, itest_run_options const *options)
+{
+  bool name_matches = options->filters.empty();
+  for (char const *filter : options->filters)
+    name_matches |= (strstr(info->name, filter) != nullptr);
+
+  bool tag_matches = options->tags.empty();
+  for (char const *tag : options->tags)
+    tag_matches |= itest_scenario_has_tag(info, tag);
+
+  bool result = name_matches && tag_matches;
+  return result;
+}
+
+// NOTE: Every scenario the filters select must be reported by exactly one shard. Shards that disagree
+// on the assignment skip scenarios or run them twice, and counting the lines wouldn't notice.
+FILE_SCOPE int merge_results_files(char const *const *args, int num_args)
+{
+  itest_run_options options = {};
+  std::vector<char const *> paths;
+  for (int i = 0; i < num_args; i++)
+  {
+    char const FILTER_ARG[] = "--filter";
+    char const TAG_ARG[]    = "--tag";
+    char const *arg         = args[i];
+    char const *arg_val_str = (i + 1 < num_args) ? args[i + 1] : nullptr;
+    if (arg_match(arg, FILTER_ARG) && arg_val_str)
+    {
+      options.filters.push_back(arg_val_str);
+      i++;
+      continue;
+    }
+
+    if (arg_match(arg, TAG_ARG) && arg_val_str)
+    {
+      options.tags.push_back(arg_val_str);
+      i++;
+      continue;
+    }
+
+    paths.push_back(arg);
+  }
+
+  int num_results   = 0;
+  int num_succeeded = 0;
+  bool all_read     = true;
+  std::unordered_map<std::string, int> times_reported;
+  for (char const *path : paths)
+  {
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+      fprintf(stderr, "Failed to open results file %s\n", path);
+      all_read = false;
+      continue;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file))
+    {
+      char *name     = line;
+      char *status   = strchr(name, '\t');
+      char *duration = status ? strchr(status + 1, '\t') : nullptr;
+      char *fail_msg = duration ? strchr(duration + 1, '\t') : nullptr;
+      if (!fail_msg) continue;
+      *status++ = 0; *duration++ = 0; *fail_msg++ = 0;
+      fail_msg[strcspn(fail_msg, "\n")] = 0;
+
+      test_result result = {};
+      result.name        = loki_fixed_string<512>("%s", name);
+      result.failed      = strcmp(status, "OK") != 0;
+      result.timed_out   = strcmp(status, "TIMEOUT") == 0;
+      result.fail_msg    = loki_fixed_string<>("%s", fail_msg);
+      result.duration_ms = static_cast<float>(atof(duration));
+      print_test_results(&result);
+      times_reported[name]++;
+
+      // NOTE: Quarantined failures are reported but don't fail the merged run
+      num_results++;
+      if (!result.failed || strcmp(status, "QUARANTINED") == 0) num_succeeded++;
+    }
+    fclose(file);
+  }
+
+  bool all_reported_once = true;
+  for (itest_scenario_info const &info : itest_scenario_registry())
   {
-    itest_read_result result = itest_read_stdout(ipc);
-    LOKI_FOR_EACH(i, possible_values_len)
+    if (info.disabled || !scenario_selected(&info, &options)) continue;
+    auto it = times_reported.find(info.name);
+    if (it == times_reported.end())
     {
-      char const *check = result.buf.c_str();
-      if (str_find(check, possible_values[i].literal.str))
-      {
-        result.matching_find_strs_index = i;
-        return result;
-      }
+      fprintf(stderr, "Scenario %s was not run by any shard\n", info.name);
+      all_reported_once = false;
+      continue;
     }
+
+    if (it->second > 1)
+    {
+      fprintf(stderr, "Scenario %s was run by %d shards\n", info.name, it->second);
+      all_reported_once = false;
+    }
+    times_reported.erase(it);
+  }
+
+  for (auto const &it : times_reported)
+  {
+    fprintf(stderr, "Scenario %s is not selected by the filters\n", it.first.c_str());
+    all_reported_once = false;
   }
+
+  printf("\nTests passed %d/%d across %zu shard(s)\n\n", num_succeeded, num_results, paths.size());
+  int result = (all_read && all_reported_once && num_results > 0 && num_succeeded == num_results) ? 0 : 1;
+  return result;
 }
 
-void itest_read_until_then_write_stdin(itest_ipc *ipc, loki_string find_str, char const *cmd)
+FILE_SCOPE void print_scenarios(itest_run_options const *options)
 {
-  itest_read_stdout_until(ipc, find_str.str);
-  itest_write_to_stdin(ipc, cmd);
+  for (itest_scenario_info const &info : itest_scenario_registry())
+  {
+    if (!scenario_selected(&info, options)) continue;
+    loki_fixed_string<128> fixture = {};
+    if (info.fixture)
+      fixture = loki_fixed_string<128>(" fixture %s (%s)", info.fixture->name, info.fixture_use == itest_fixture_use::read_only ? "read-only" : "mutates");
+    printf("%-80s hf%-2d %2d daemon(s) %d wallet(s) [%s]%s%s\n", info.name, info.hf_version, info.daemons, info.wallets, info.tags, fixture.str, info.disabled ? " (disabled)" : "");
+  }
 }
 
 // -------------------------------------------------------------------------------------------------
 //
-// daemon
+// isolated workers
 //
 // -------------------------------------------------------------------------------------------------
-struct state_t
+// NOTE: In isolated mode each scenario runs in a pre-forked worker process so an assert or exit in one
+// scenario only fails that scenario. The parent stays single threaded so it can safely fork
+// replacements for workers that die. Each worker leads a process group, the daemons and wallets it
+// launches join it and are killed with it.
+int const ITEST_ISOLATED_DEADLINE_GRACE_S = 60; // The worker's own watchdog should time the scenario out before the parent has to
+
+struct itest_isolated_cmd
 {
-  std::atomic<int> num_wallets         = 0;
-  std::atomic<int> num_daemons         = 0;
-  std::atomic<int> free_p2p_port       = 1111;
-  std::atomic<int> free_rpc_port       = 2222;
-  std::atomic<int> free_zmq_port       = 3333;
-  std::atomic<int> free_quorumnet_port = 4444;
+  int        job_index;
+  os_cpu_set cpus;
 };
-FILE_SCOPE state_t global_state;
 
-daemon_t create_daemon()
+struct itest_isolated_result
 {
-  daemon_t result       = {};
-  result.id             = global_state.num_daemons++;
-  result.p2p_port       = global_state.free_p2p_port++;
-  result.rpc_port       = global_state.free_rpc_port++;
-  result.zmq_rpc_port   = global_state.free_zmq_port++;
-  result.quorumnet_port = global_state.free_quorumnet_port++;
-  return result;
-}
+  int         job_index;
+  test_result result;
+};
 
-void start_daemon(daemon_t *daemons, int num_daemons, start_daemon_params *params, int num_params, char const *terminal_name)
+struct itest_isolated_worker
 {
-  // TODO(doyle): Not very efficient
-  std::vector<std::thread> threads;
-  threads.reserve(num_daemons);
+  int                                   index;
+  int                                   pid;
+  int                                   cmd_fd;     // Parent writes an itest_isolated_cmd with the job to run
+  int                                   result_fd;  // Worker writes back an itest_isolated_result
+  itest_job                            *job;        // In flight, nullptr when idle
+  std::chrono::steady_clock::time_point start_time;
+  bool                                  killed;     // Past the deadline and unresponsive
+  bool                                  cancelled;  // Killed because the run is stopping
+  bool                                  reaped;     // Reaped whilst collecting orphans, exit_status is valid
+  int                                   exit_status;
+};
 
-  LOKI_ASSERT(num_params == num_daemons || num_params == 1);
-  for (int curr_daemon_index = 0; curr_daemon_index < num_daemons; ++curr_daemon_index)
+FILE_SCOPE bool write_all(int fd, void const *buf, int size)
+{
+  for (int bytes_written = 0; bytes_written < size;)
   {
-    start_daemon_params param = (num_params == 1) ? params[0] : params[curr_daemon_index];
-    daemon_t *curr_daemon = daemons + curr_daemon_index;
-
-    loki_fixed_string<> arg_buf = {};
-    arg_buf.append("--p2p-bind-port %d ",            curr_daemon->p2p_port);
-    arg_buf.append("--rpc-bind-port %d ",            curr_daemon->rpc_port);
-    arg_buf.append("--zmq-rpc-bind-port %d ",        curr_daemon->zmq_rpc_port);
-    arg_buf.append("--quorumnet-port %d ",           curr_daemon->quorumnet_port);
-    arg_buf.append("--data-dir ./output/daemon_%d ", curr_daemon->id);
-    arg_buf.append("--storage-server-port 4444 ");
-    arg_buf.append("--service-node-public-ip 123.123.123.123 ");
-    arg_buf.append("--dev-allow-local-ips ");
-
-    if (num_daemons == 1)
-      arg_buf.append("--offline ");
+    int num_bytes = write(fd, static_cast<char const *>(buf) + bytes_written, size - bytes_written);
+    if (num_bytes == -1 && errno == EINTR) continue;
+    if (num_bytes <= 0) return false;
+    bytes_written += num_bytes;
+  }
+  return true;
+}
 
-    if (param.service_node)
-      arg_buf.append("--service-node ");
+FILE_SCOPE bool read_all(int fd, void *buf, int size)
+{
+  for (int bytes_read = 0; bytes_read < size;)
+  {
+    int num_bytes = read(fd, static_cast<char *>(buf) + bytes_read, size - bytes_read);
+    if (num_bytes == -1 && errno == EINTR) continue;
+    if (num_bytes <= 0) return false;
+    bytes_read += num_bytes;
+  }
+  return true;
+}
 
-    if (param.fixed_difficulty > 0)
-      arg_buf.append("--fixed-difficulty %d ", param.fixed_difficulty);
+[[noreturn]] FILE_SCOPE void isolated_worker_main(int worker_index, int num_workers, int cmd_fd, int result_fd, os_cpu_set harness_cpus)
+{
+  setpgid(0, 0);
+  prctl(PR_SET_PDEATHSIG, SIGKILL); // NOTE: Don't outlive the parent, nobody would be reading the results
+  global_state.process_groups = false;
+  os_set_thread_affinity(harness_cpus);
+
+  itest_use_worker(worker_index, num_workers);
+  os_file_dir_make(global_state.output_dir.str);
+  int const first_p2p_port       = global_state.free_p2p_port;
+  int const first_rpc_port       = global_state.free_rpc_port;
+  int const first_zmq_port       = global_state.free_zmq_port;
+  int const first_quorumnet_port = global_state.free_quorumnet_port;
+
+  // NOTE: The queue was copied from the parent, nothing has started in this process. The watchdog runs
+  // until the worker exits, it only stops once every job has started.
+  global_work_queue.num_jobs_started = 0;
+  global_work_queue.num_jobs_running = 0;
+  std::thread(thread_to_watchdog, harness_cpus).detach();
 
-    if (param.num_hardforks > 0)
+  for (;;)
+  {
+    itest_isolated_cmd cmd = {};
+    if (!read_all(cmd_fd, &cmd, sizeof(cmd)))
+      _exit(0); // NOTE: Parent closed the pipe, no more work
+
+    // NOTE: One scenario at a time, every scenario can start from the beginning of the worker's ports
+    global_state.free_p2p_port       = first_p2p_port;
+    global_state.free_rpc_port       = first_rpc_port;
+    global_state.free_zmq_port       = first_zmq_port;
+    global_state.free_quorumnet_port = first_quorumnet_port;
+
+    itest_isolated_result msg       = {};
+    msg.job_index                   = cmd.job_index;
+    itest_job *job                  = &global_work_queue.jobs[cmd.job_index];
+    job->cpus                       = cmd.cpus; // NOTE: Claimed by the parent after this worker was forked
+    itest_scenario_context *context = new_scenario_context(job);
     {
-      arg_buf.append("--integration-test-hardforks-override \\\"");
-      for (int i = 0; i < param.num_hardforks; ++i)
-      {
-        loki_hardfork hardfork = param.hardforks[i];
-        arg_buf.append("%d:%d", hardfork.version, hardfork.height);
-        if (i != (param.num_hardforks - 1)) arg_buf.append(", ");
-      }
-
-      arg_buf.append("\\\" ");
-      LOKI_ASSERT(param.nettype == loki_nettype::fakenet);
+      std::lock_guard<std::mutex> lock(global_work_queue.mutex);
+      job->context                       = context;
+      global_work_queue.num_jobs_running = 1;
     }
-    else
+
+    msg.result = run_scenario(job, context);
     {
-      if (param.nettype == loki_nettype::testnet)
-        arg_buf.append("--testnet ");
-      else if (param.nettype == loki_nettype::stagenet)
-        arg_buf.append("--stagnet ");
+      std::lock_guard<std::mutex> lock(global_work_queue.mutex);
+      job->context                       = nullptr;
+      global_work_queue.num_jobs_running = 0;
     }
+    delete context;
 
-    loki_fixed_string<128> name("%s%d", DAEMON_IPC_NAME, curr_daemon->id);
-    arg_buf.append("--integration-test-pipe-name %s ", name.str);
-
-    for (int other_daemon_index = 0; other_daemon_index < num_daemons; ++other_daemon_index)
-    {
-      if (curr_daemon_index == other_daemon_index)
-        continue;
+    if (!write_all(result_fd, &msg, sizeof(msg)))
+      _exit(1);
+  }
+}
 
-      daemon_t const *other_daemon = daemons + other_daemon_index;
-      arg_buf.append("--add-exclusive-node 127.0.0.1:%d ", other_daemon->p2p_port);
-    }
+FILE_SCOPE bool fork_isolated_worker(itest_isolated_worker *worker, std::vector<itest_isolated_worker> const &workers, os_cpu_set harness_cpus)
+{
+  int cmd_pipe[2]    = {};
+  int result_pipe[2] = {};
+  if (pipe2(cmd_pipe, O_CLOEXEC) == -1 || pipe2(result_pipe, O_CLOEXEC) == -1)
+  {
+    perror("Failed to create isolated worker pipes");
+    return false;
+  }
 
-    arg_buf.append("%s ", param.custom_cmd_line.str);
-    if (curr_daemon->id == 1)
+  fflush(stdout); // NOTE: Don't let the worker inherit and print a copy of whatever is buffered
+  fflush(stderr);
+  int pid = fork();
+  if (pid == 0)
+  {
+    close(cmd_pipe[1]);
+    close(result_pipe[0]);
+    for (itest_isolated_worker const &other : workers)
     {
-      // continue;
+      if (&other == worker || other.pid <= 0) continue;
+      close(other.cmd_fd);
+      close(other.result_fd);
     }
+    isolated_worker_main(worker->index, static_cast<int>(workers.size()), cmd_pipe[0], result_pipe[1], harness_cpus);
+  }
 
-    loki_fixed_string<> cmd_buf = {};
-    if (param.keep_terminal_open) cmd_buf = loki_fixed_string<>(LOKI_CMD_FMT, curr_daemon->id, terminal_name, arg_buf.str, "bash");
-    else                          cmd_buf = loki_fixed_string<>(LOKI_CMD_FMT, curr_daemon->id, terminal_name, arg_buf.str, "");
-
-    threads.push_back(std::thread([curr_daemon, cmd_buf]()
-    {
-      curr_daemon->proc_handle = os_launch_process(cmd_buf.str);
-      curr_daemon->ipc = itest_ipc_setup(DAEMON_IPC_NAME, curr_daemon->id);
-      daemon_status(curr_daemon);
-    }));
+  close(cmd_pipe[0]);
+  close(result_pipe[1]);
+  if (pid == -1)
+  {
+    perror("Failed to fork isolated worker");
+    close(cmd_pipe[1]);
+    close(result_pipe[0]);
+    return false;
   }
 
-  for (std::thread &daemon_launching_thread : threads)
-    daemon_launching_thread.join();
+  worker->pid       = pid;
+  worker->cmd_fd    = cmd_pipe[1];
+  worker->result_fd = result_pipe[0];
+  worker->job       = nullptr;
+  worker->killed    = false;
+  worker->cancelled = false;
+  worker->reaped    = false;
+  return true;
 }
 
-daemon_t create_and_start_daemon(start_daemon_params params, char const *terminal_name)
+FILE_SCOPE test_result isolated_worker_died_result(itest_isolated_worker const *worker)
 {
-  daemon_t result = create_daemon();
-  start_daemon(&result, 1, &params, 1, terminal_name);
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - worker->start_time).count();
+  int status    = worker->exit_status;
+
+  test_result result = {};
+  result.name        = loki_fixed_string<512>("%s", worker->job->name);
+  result.failed      = true;
+  result.timed_out   = worker->killed && !worker->cancelled;
+  result.duration_ms = duration / 1000.f;
+  if (worker->cancelled)        result.fail_msg = loki_fixed_string<>("Cancelled, %s", global_work_queue.stop_reason.str);
+  else if (worker->killed)      result.fail_msg = loki_fixed_string<>("Worker unresponsive %ds past the deadline of %ds, killed", ITEST_ISOLATED_DEADLINE_GRACE_S, worker->job->timeout_s);
+  else if (WIFSIGNALED(status)) result.fail_msg = loki_fixed_string<>("Worker crashed with signal %d (%s)", WTERMSIG(status), strsignal(WTERMSIG(status)));
+  else                          result.fail_msg = loki_fixed_string<>("Worker exited with code %d before reporting a result", WEXITSTATUS(status));
   return result;
 }
 
-void create_and_start_multi_daemons(daemon_t *daemons, int num_daemons, start_daemon_params *params, int num_params, char const *terminal_name)
+// NOTE: Orphans of dead workers are reparented to us as the subreaper, collect them and note the
+// status of any worker that got reaped along the way.
+FILE_SCOPE void reap_exited_children(std::vector<itest_isolated_worker> *workers)
 {
-  for (int i = 0; i < num_daemons; ++i)
-    daemons[i] = create_daemon();
-  start_daemon(daemons, num_daemons, params, num_params, terminal_name);
+  for (;;)
+  {
+    int status = 0;
+    int pid    = waitpid(-1, &status, WNOHANG);
+    if (pid <= 0) break;
+    for (itest_isolated_worker &worker : *workers)
+    {
+      if (worker.pid != pid) continue;
+      worker.reaped      = true;
+      worker.exit_status = status;
+    }
+  }
 }
 
-// -------------------------------------------------------------------------------------------------
-//
-// wallet
-//
-// -------------------------------------------------------------------------------------------------
-wallet_t create_and_start_wallet(loki_nettype type, start_wallet_params params, char const *terminal_name)
+FILE_SCOPE void run_isolated_workers(int num_workers, os_cpu_set harness_cpus)
 {
-  wallet_t result = {};
-  result.id       = global_state.num_wallets++;
-  result.nettype  = type;
+  prctl(PR_SET_CHILD_SUBREAPER, 1);
 
-  loki_fixed_string<> arg_buf = {};
-  if (result.nettype == loki_nettype::testnet)       arg_buf.append("--testnet ");
-  else if (result.nettype == loki_nettype::fakenet)  arg_buf.append("--regtest ");
-  else if (result.nettype == loki_nettype::stagenet) arg_buf.append("--stagenet ");
-
-  arg_buf.append("--generate-new-wallet ./output/wallet_%d ", result.id);
-  arg_buf.append("--password '' ");
-  arg_buf.append("--mnemonic-language English ");
+  std::vector<itest_isolated_worker> workers(num_workers);
+  for (int i = 0; i < num_workers; i++)
+  {
+    workers[i]       = {};
+    workers[i].index = i;
+    workers[i].pid   = -1;
+  }
 
-  if (params.allow_mismatched_daemon_version)
-    arg_buf.append("--allow-mismatched-daemon-version ");
+  for (itest_isolated_worker &worker : workers)
+    fork_isolated_worker(&worker, workers, harness_cpus);
 
-  if (params.daemon)
-    arg_buf.append("--daemon-address 127.0.0.1:%d ", params.daemon->rpc_port);
+  std::vector<pollfd> fds;
+  std::vector<itest_isolated_worker *> polled_workers;
+  for (;;)
+  {
+    {
+      std::lock_guard<std::mutex> lock(global_work_queue.mutex);
+      for (itest_isolated_worker &worker : workers)
+      {
+        if (worker.pid <= 0 || worker.job) continue;
+        itest_job *job = next_job_that_fits();
+        if (!job) break;
+
+        start_job(job);
+        worker.job        = job;
+        worker.start_time = std::chrono::steady_clock::now();
+        itest_isolated_cmd cmd = {static_cast<int>(job - global_work_queue.jobs.data()), job->cpus};
+        write_all(worker.cmd_fd, &cmd, sizeof(cmd)); // NOTE: A dead worker shows up as EOF on its result pipe
+      }
 
-  loki_fixed_string<128> name("%s%d", WALLET_IPC_NAME, result.id);
-  arg_buf.append("--integration-test-pipe-name %s ", name.str);
+      if (os_interrupted())
+        stop_work_queue("interrupted");
 
-#if 1
-  loki_fixed_string<> cmd_buf = {};
-  if (params.keep_terminal_open) cmd_buf = loki_fixed_string<>(LOKI_WALLET_CMD_FMT, result.id, terminal_name, arg_buf.str, "bash");
-  else                           cmd_buf = loki_fixed_string<>(LOKI_WALLET_CMD_FMT, result.id, terminal_name, arg_buf.str, "");
-  result.proc_handle = os_launch_process(cmd_buf.str);
-
-  result.ipc = itest_ipc_setup(WALLET_IPC_NAME, result.id);
-  itest_read_possible_value const possible_values[] =
-  {
-    {LOKI_STRING("Error: refresh failed"), true},
-    {LOKI_STRING("Error: refresh failed: unexpected error: proxy exception in refresh thread"), true},
-    {LOKI_STRING("Balance"),               false},
-  };
-
-  itest_read_possible_value const *proxy_exception_error = possible_values + 1;
-  itest_read_result read_result = itest_read_stdout_until(&result.ipc, possible_values, LOKI_ARRAY_COUNT(possible_values));
-  LOKI_ASSERT_MSG(!str_find(read_result.buf.c_str(), proxy_exception_error->literal.str), "This shows up when you launch the daemon in the incorrect nettype and the wallet tries to forcefully refresh from it");
-#endif
-  return result;
-}
+      if (global_work_queue.stopping)
+      {
+        for (itest_isolated_worker &worker : workers)
+        {
+          if (!worker.job || worker.killed) continue;
+          worker.killed    = true;
+          worker.cancelled = true;
+          os_kill_process_group(worker.pid); // NOTE: Shows up as EOF on the next poll
+        }
+      }
 
-// -------------------------------------------------------------------------------------------------
-//
-// loki_integration_tests
-//
-// -------------------------------------------------------------------------------------------------
-#include <vector>
-#include <thread>
+      if (work_queue_drained())
+        break;
+    }
 
-typedef test_result(itest_scenario)(void);
-struct work_queue
-{
-  std::atomic<size_t>           job_index;
-  std::vector<itest_scenario *> jobs;
-  std::atomic<size_t>           num_jobs_succeeded;
-};
+    fds.clear();
+    polled_workers.clear();
+    for (itest_isolated_worker &worker : workers)
+    {
+      if (!worker.job) continue;
+      fds.push_back({worker.result_fd, POLLIN, 0});
+      polled_workers.push_back(&worker);
+    }
 
-FILE_SCOPE work_queue global_work_queue;
-void thread_to_task_dispatcher()
-{
-  for (;;)
-  {
-    size_t selected_job_index = global_work_queue.job_index.load();
-    if (selected_job_index >= global_work_queue.jobs.size())
+    if (fds.empty())
+    {
+      fprintf(stderr, "Every isolated worker failed to start, %zu scenario(s) were not run\n", global_work_queue.jobs.size() - global_work_queue.num_jobs_started);
       break;
+    }
 
-    size_t next_job_index = selected_job_index + 1;
-    if (global_work_queue.job_index.compare_exchange_strong(selected_job_index,
-                                                            next_job_index,
-                                                            std::memory_order_acq_rel))
+    poll(fds.data(), fds.size(), 1000 /*timeout_ms*/);
+    auto const now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < fds.size(); i++)
     {
-      itest_scenario *run_scenario = global_work_queue.jobs[selected_job_index];
-      test_result result = run_scenario();
-      print_test_results(&result);
+      itest_isolated_worker *worker = polled_workers[i];
+      if (!fds[i].revents)
+      {
+        auto deadline = worker->start_time + std::chrono::seconds(worker->job->timeout_s + ITEST_ISOLATED_DEADLINE_GRACE_S);
+        if (!worker->killed && now > deadline)
+        {
+          worker->killed = true;
+          os_kill_process_group(worker->pid); // NOTE: Shows up as EOF on the next poll
+        }
+        continue;
+      }
+
+      itest_isolated_result msg = {};
+      itest_job *job            = worker->job;
+      if (read_all(worker->result_fd, &msg, sizeof(msg)))
+      {
+        worker->job = nullptr;
+        finish_job(job, job->cost.budget(), msg.result);
+        continue;
+      }
+
+      // NOTE: Worker died mid-scenario, take down whatever it launched with it
+      os_kill_process_group(worker->pid);
+      if (!worker->reaped && waitpid(worker->pid, &worker->exit_status, 0) == worker->pid)
+        worker->reaped = true;
+
+      finish_job(job, job->cost.budget(), isolated_worker_died_result(worker));
+      close(worker->cmd_fd);
+      close(worker->result_fd);
+      worker->pid = -1;
+      worker->job = nullptr;
 
-      if (!result.failed)
-        global_work_queue.num_jobs_succeeded++;
+      bool const more_jobs = global_work_queue.num_jobs_started < global_work_queue.jobs.size() && !global_work_queue.stopping;
+      if (more_jobs)
+        fork_isolated_worker(worker, workers, harness_cpus);
     }
+
+    reap_exited_children(&workers);
+  }
+
+  for (itest_isolated_worker &worker : workers)
+  {
+    if (worker.pid <= 0) continue;
+    close(worker.cmd_fd); // NOTE: Idle workers exit once they read EOF
+    close(worker.result_fd);
+    if (!worker.reaped && !os_wait_for_process_exit(worker.pid, 5000 /*timeout_ms*/))
+      os_kill_process_group(worker.pid);
   }
+  reap_exited_children(&workers);
 }
 
 FILE_SCOPE void print_help()
 {
   fprintf(stdout, "Integration Test Startup Flags\n\n");
-  fprintf(stdout, "  --generate-blockchain         |                Generate a blockchain instead of running tests. Flags below are optionally specified.\n");
+  fprintf(stdout, "  --generate-blockchain         |                Generate a blockchain into ./loki_blockchain_<hash>.tar.gz instead of running tests. Flags below are optionally specified.\n");
   fprintf(stdout, "    --service-nodes     <value> | (Default: 0)   How many service nodes to generate in the blockchain\n");
   fprintf(stdout, "    --daemons           <value> | (Default: 1)   How many normal daemons to generate in the blockchain\n");
   fprintf(stdout, "    --wallets           <value> | (Default: 1)   How many wallets to generate for the blockchain\n");
   fprintf(stdout, "    --wallet-balance    <value> | (Default: 100) How much Loki each wallet should have (non-atomic units)\n");
   fprintf(stdout, "    --fixed-difficulty  <value> | (Default: 1)   Blocks should be mined with set difficulty, 0 to use the normal difficulty algorithm\n");
-  // fprintf(stdout, "  --num-blocks    <value> | (Default: 100) How many blocks to generate in the blockchain, minimum 100\n");
+  fprintf(stdout, "    --wallet-seed       <value> |                Generate the wallets from keys derived from this seed so the blockchain is reproducible\n");
+  fprintf(stdout, "    --num-blocks        <value> | (Default: 100) How many blocks to generate in the blockchain, minimum 100\n");
+  fprintf(stdout, "\nTest Run Flags\n\n");
+  fprintf(stdout, "  --no-cpu-pinning              |                Don't partition the CPUs between scenarios, let processes float across every core\n");
+  fprintf(stdout, "  --harness-cpus        <value> | (Default: 0)   Reserve this many CPUs for the harness threads, scenarios are pinned to the remainder\n");
+  fprintf(stdout, "  --no-fixture-cache            |                Always mine the blockchain setups from scratch instead of restoring them from ./fixture_cache\n");
+  fprintf(stdout, "  --list                        |                Print the registered scenarios that match the filters and exit\n");
+  fprintf(stdout, "  --filter              <value> |                Only run scenarios whose name contains the value, can be given multiple times\n");
+  fprintf(stdout, "  --tag                 <value> |                Only run scenarios with the tag, i.e. checkpointing, staking, transfer. Can be given multiple times\n");
+  fprintf(stdout, "  --shard               <value> |                Run one shard of the scenarios, i.e. 2/4, up to 7 shards. Every shard must be given the same filters and --shard-history\n");
+  fprintf(stdout, "  --shard-history       <value> |                Balance the shards by the durations in this copy of ./itest_history.txt, it is never written to\n");
+  fprintf(stdout, "  --results-file        <value> |                Write the result of each scenario to this file for --merge-results\n");
+  fprintf(stdout, "  --isolate                     |                Run each scenario in a forked worker process so a crash only fails that scenario\n");
+  fprintf(stdout, "  --retries             <value> | (Default: 0)   Rerun a failed scenario up to this many times at the end of the run before it counts as a failure\n");
+  fprintf(stdout, "  --no-quarantine               |                Let scenarios that flake often in ./itest_flakes.txt fail the run instead of quarantining them\n");
+  fprintf(stdout, "  --no-admission-control        |                Start scenarios whenever they fit the startup budget, ignoring the load and memory pressure\n");
+  fprintf(stdout, "  --fail-fast                   |                Stop on the first failure, cancel the running scenarios and kill their processes\n");
+  fprintf(stdout, "  --no-shared-fixtures          |                Give every scenario its own fixture instead of running the read-only ones on a shared instance\n");
+  fprintf(stdout, "  --wallet-seed         <value> |                Generate setup wallets from keys derived from this seed, the scenario and the wallet index\n");
+  fprintf(stdout, "\nMerging Shards\n\n");
+  fprintf(stdout, "  --merge-results  <file> [...] |                Combine the results files of each shard into one report, exits non-zero on any failure\n");
+  fprintf(stdout, "    --filter            <value> |                The filters the shards were run with, every scenario they select must be reported exactly once\n");
+  fprintf(stdout, "    --tag               <value> |                The tags the shards were run with\n");
 }
 
 enum struct daemon_type
@@ -518,7 +2525,7 @@ enum struct daemon_type
   service_node,
 };
 
-FILE_SCOPE void write_daemon_launch_script(helper_blockchain_environment const *environment, daemon_type type)
+FILE_SCOPE bool write_daemon_launch_script(helper_blockchain_environment const *environment, daemon_type type)
 {
   daemon_t const *from  = nullptr;
   int num_from          = 0;
@@ -544,40 +2551,20 @@ FILE_SCOPE void write_daemon_launch_script(helper_blockchain_environment const *
 
   LOKI_FOR_EACH(daemon_index, num_from)
   {
-    loki_fixed_string<> cmd_line("./lokid ");
     daemon_t const *daemon = from + daemon_index;
-    cmd_line.append("--data-dir daemon_%d ",  daemon->id);
-    cmd_line.append("--fixed-difficulty %d ", environment->daemon_param.fixed_difficulty);
-    cmd_line.append("--p2p-bind-port %d ", daemon->p2p_port);
-    cmd_line.append("--rpc-bind-port %d ", daemon->rpc_port);
-    cmd_line.append("--zmq-rpc-bind-port %d ", daemon->zmq_rpc_port);
-    cmd_line.append("--quorumnet--port %d ", daemon->quorumnet_port);
-    cmd_line.append("--log-level 1 ");
-    cmd_line.append("--dev-allow-local-ips ");
-
-    if (environment->daemon_param.nettype      == loki_nettype::testnet)  cmd_line.append("--testnet ");
-    else if (environment->daemon_param.nettype == loki_nettype::stagenet) cmd_line.append("--stagenet ");
-
-    if (type == daemon_type::service_node) 
-    {
-      cmd_line.append("--service-node ");
-      cmd_line.append("--service-node-public-ip 123.123.123.123 ");
-      cmd_line.append("--storage-server-port 8080 ");
-    }
-
-    LOKI_FOR_EACH(index, num_from)
-    {
-      daemon_t const *other_daemon = from + index;
-      if (index == daemon_index) continue;
-      cmd_line.append("--add-exclusive-node 127.0.0.1:%d ", other_daemon->p2p_port);
-    }
-
-    LOKI_FOR_EACH(index, num_other)
-    {
-      daemon_t const *other_daemon = other + index;
-      cmd_line.append("--add-exclusive-node 127.0.0.1:%d ", other_daemon->p2p_port);
-    }
 
+    daemon_launch_spec spec    = {};
+    spec.daemon                = daemon;
+    spec.params                = environment->daemon_param;
+    spec.params.service_node   = (type == daemon_type::service_node);
+    spec.data_dir              = loki_fixed_string<256>("daemon_%d", daemon->id);
+    spec.integration_test_mode = false;
+    spec.log_level             = 1;
+    spec.storage_server_port   = (type == daemon_type::service_node) ? 8080 : 0;
+    spec.add_exclusive_nodes(from, num_from);
+    spec.add_exclusive_nodes(other, num_other);
+
+    std::string cmd_line = spec.build().to_shell_cmd();
     loki_fixed_string<> file_name("./output/");
     file_name.append("daemon_");
     file_name.append("%d", daemon->id);
@@ -585,20 +2572,62 @@ FILE_SCOPE void write_daemon_launch_script(helper_blockchain_environment const *
       file_name.append("_service_node_%d", daemon_index);
     file_name.append(".sh");
 
-    if (!os_write_file(file_name.str, cmd_line.str, cmd_line.len))
+    if (!os_write_file(file_name.str, cmd_line.c_str(), static_cast<int>(cmd_line.size())) || !os_file_make_executable(file_name.str))
     {
       fprintf(stderr, "Failed to create daemon launcher script file: %s\n", file_name.str);
-      continue;
+      return false;
     }
   }
+
+  return true;
+}
+
+// NOTE: Packs the generated network into one archive named after the SHA-256 of its contents, with a
+// sha256sum file next to it, so staging environments can pull a prebuilt network and verify it. File
+// times and owners are left out of the tar and gzip headers so the hash only depends on the files.
+FILE_SCOPE bool write_blockchain_archive(char const *output_dir)
+{
+  char const STAGING_TAR[]     = "./loki_blockchain.staging.tar";
+  char const STAGING_ARCHIVE[] = "./loki_blockchain.staging.tar.gz";
+
+  loki_fixed_string<512> archive_cmd("tar --sort=name --mtime=@0 --owner=0 --group=0 --numeric-owner --exclude=./*.log -cf %s -C %s . && gzip -nf %s", STAGING_TAR, output_dir, STAGING_TAR);
+  FILE *archive_process = os_launch_process(archive_cmd.str);
+  if (!archive_process || pclose(archive_process) != 0)
+  {
+    fprintf(stderr, "Failed to archive the blockchain in %s\n", output_dir);
+    return false;
+  }
+
+  char hash[64 + 1]   = {};
+  FILE *hash_process  = os_launch_process(loki_fixed_string<256>("sha256sum %s", STAGING_ARCHIVE).str);
+  bool hashed         = hash_process && fscanf(hash_process, "%64s", hash) == 1;
+  if (hash_process) hashed &= (pclose(hash_process) == 0);
+  if (!hashed)
+  {
+    fprintf(stderr, "Failed to hash the blockchain archive %s\n", STAGING_ARCHIVE);
+    return false;
+  }
+
+  loki_fixed_string<256> archive_name("loki_blockchain_%.16s.tar.gz", hash);
+  loki_fixed_string<256> hash_file("./%s.sha256", archive_name.str);
+  std::string hash_line = loki_fixed_string<512>("%s  %s\n", hash, archive_name.str).str;
+  if (rename(STAGING_ARCHIVE, archive_name.str) != 0 || !os_write_file(hash_file.str, hash_line.c_str(), static_cast<int>(hash_line.size())))
+  {
+    fprintf(stderr, "Failed to write the blockchain archive %s\n", archive_name.str);
+    return false;
+  }
+
+  printf("Blockchain archived to ./%s (sha256 %s)\n", archive_name.str, hash);
+  return true;
 }
 
 FILE_SCOPE void delete_old_blockchain_files()
 {
-  if (os_file_exists("./output/"))
+  char const *output_dir = global_state.output_dir.str;
+  if (os_file_exists(output_dir))
   {
-    os_file_dir_delete("./output");
-    os_file_dir_make("./output");
+    os_file_dir_delete(output_dir);
+    os_file_dir_make(output_dir);
   }
 }
 
@@ -615,43 +2644,33 @@ int main(int argc, char **argv)
   //    which means when it fails, we need to step into the debugger and inspect
   //    the program to figure out why it failed.
 
-  if (argc > 1)
+  char const HELP_ARG[]     = "--help";
+  char const GENERATE_ARG[] = "--generate-blockchain";
+  for (int i = 1; i < argc; i++)
   {
-    for (int i = 1; i < argc; i++)
+    if (arg_match(argv[i], HELP_ARG))
     {
-      char const *arg       = argv[i];
-      int arg_len           = strlen(arg);
-      char const HELP_ARG[] = "--help";
-
-      if (arg_len == char_count_i(HELP_ARG) && strncmp(arg, HELP_ARG, arg_len) == 0)
-      {
-        print_help();
-        return true;
-      }
-
-      char const GENERATE_ARG[] = "--generate-blockchain";
-      if (arg_len == char_count_i(GENERATE_ARG) && strncmp(arg, GENERATE_ARG, arg_len) == 0)
-      {
-        break;
-      }
-      else
-      {
-        fprintf(stderr, "Unrecognised argument %s\n\n", arg);
-        print_help();
-        return false;
-      }
+      print_help();
+      return 0;
     }
+  }
 
+  char const MERGE_ARG[] = "--merge-results";
+  if (argc > 1 && arg_match(argv[1], MERGE_ARG))
+    return merge_results_files(argv + 2, argc - 2);
+
+  if (argc > 1 && arg_match(argv[1], GENERATE_ARG))
+  {
     int num_options = argc - 2;
     if ((num_options % 2) != 0)
     {
       fprintf(stderr, "Invalid number of options, each --<option> should have a value associated with it, i.e. --option <value>\n");
-      return false;
+      return 1;
     }
 
     int num_daemons       = 1;
     int num_service_nodes = 0;
-    // int num_blocks        = MIN_BLOCKS_IN_BLOCKCHAIN;
+    int num_blocks        = MIN_BLOCKS_IN_BLOCKCHAIN;
     int num_wallets            = 1;
     int initial_wallet_balance = 1;
     int fixed_difficulty       = 1;
@@ -666,6 +2685,7 @@ int main(int argc, char **argv)
       char const WALLET_ARG[]         = "--wallets";
       char const WALLET_BALANCE_ARG[] = "--wallet-balance";
       char const FIXED_DIFF_ARG[]     = "--fixed-difficulty";
+      char const WALLET_SEED_ARG[]    = "--wallet-seed";
 
       char const *arg_val_str = argv[i + 1];
       int arg_val             = atoi(arg_val_str);
@@ -679,6 +2699,7 @@ int main(int argc, char **argv)
         wallets,
         wallet_balance,
         fixed_difficulty,
+        wallet_seed,
       };
 
       arg_type type = arg_type::invalid;
@@ -706,10 +2727,23 @@ int main(int argc, char **argv)
       {
         type = arg_type::fixed_difficulty;
       }
+      else if (arg_len == char_count_i(WALLET_SEED_ARG) && strncmp(arg, WALLET_SEED_ARG, arg_len) == 0)
+      {
+        type = arg_type::wallet_seed;
+      }
       else
       {
         fprintf(stderr, "Unrecognised argument %s with value %s\n", arg, arg_val_str);
-        return false;
+        return 1;
+      }
+
+      // NOTE: Seeds are 64 bit, they don't go through atoi like the other values
+      if (type == arg_type::wallet_seed)
+      {
+        if (!parse_wallet_seed(arg, arg_val_str, &helper_wallet_seed))
+          return 1;
+        helper_deterministic_wallets = true;
+        continue;
       }
 
       if (arg_val < 0)
@@ -720,7 +2754,7 @@ int main(int argc, char **argv)
         else
         {
           fprintf(stderr, "Argument %s has invalid value %s\n", arg, arg_val_str);
-          return false;
+          return 1;
         }
       }
 
@@ -734,12 +2768,12 @@ int main(int argc, char **argv)
       }
       else if (type == arg_type::num_blocks)
       {
-        if (arg_val < 100)
+        if (arg_val < MIN_BLOCKS_IN_BLOCKCHAIN)
         {
-          fprintf(stdout, "Warning: Num blocks specified less than 100: %d, the minimum is 100. Overriding to 100\n", arg_val);
-          arg_val = 100;
+          fprintf(stdout, "Warning: Num blocks specified less than %d: %d, the minimum is %d. Overriding to %d\n", MIN_BLOCKS_IN_BLOCKCHAIN, arg_val, MIN_BLOCKS_IN_BLOCKCHAIN, MIN_BLOCKS_IN_BLOCKCHAIN);
+          arg_val = MIN_BLOCKS_IN_BLOCKCHAIN;
         }
-        // num_blocks = arg_val;
+        num_blocks = arg_val;
       }
       else if (type == arg_type::wallets)
       {
@@ -755,6 +2789,7 @@ int main(int argc, char **argv)
       }
     }
 
+    helper_fixture_cache_enabled = false; // NOTE: The launch scripts reference the data dirs of the daemons we mine with
     delete_old_blockchain_files();
     test_result context = {};
     INITIALISE_TEST_CONTEXT(context);
@@ -762,32 +2797,92 @@ int main(int argc, char **argv)
     start_daemon_params params                = {};
     params.fixed_difficulty                   = fixed_difficulty;
     helper_blockchain_environment environment = {};
-    helper_setup_blockchain(&environment, &context, params, num_service_nodes, num_daemons, num_wallets, initial_wallet_balance);
+    bool generated  = helper_setup_blockchain(&environment, &context, params, num_service_nodes, num_daemons, num_wallets, initial_wallet_balance, num_blocks);
+    uint64_t height = generated ? daemon_status(environment.all_daemons.data()).height : 0;
     helper_cleanup_blockchain_environment(&environment);
+    helper_print_sync_metrics();
+    if (!generated)
+    {
+      fprintf(stderr, "Failed to generate the blockchain\n");
+      return 1;
+    }
 
-    write_daemon_launch_script(&environment, daemon_type::normal);
-    write_daemon_launch_script(&environment, daemon_type::service_node);
+    // NOTE: The daemons and wallets write their files out on exit, wait for that before archiving them
+    int const EXIT_TIMEOUT_MS = 30 * 1000;
+    for (daemon_t const &daemon : environment.all_daemons)
+      if (!os_wait_for_process_exit(daemon.pid, EXIT_TIMEOUT_MS)) itest_kill_process(daemon.pid);
+    for (wallet_t const &wallet : environment.wallets)
+      if (!os_wait_for_process_exit(wallet.pid, EXIT_TIMEOUT_MS)) itest_kill_process(wallet.pid);
+
+    if (!write_daemon_launch_script(&environment, daemon_type::normal) || !write_daemon_launch_script(&environment, daemon_type::service_node))
+      return 1;
 
     for (wallet_t &wallet : environment.wallets)
     {
-      loki_fixed_string<> cmd_line("./loki-wallet-cli --daemon-address 127.0.0.1:2222 --wallet-file wallet_%d --password '' ", wallet.id);
-      if (environment.daemon_param.nettype      == loki_nettype::testnet)  cmd_line.append("--testnet ");
-      else if (environment.daemon_param.nettype == loki_nettype::stagenet) cmd_line.append("--stagenet ");
-
+      itest_launch_args wallet_args = {};
+      wallet_args.add("./loki-wallet-cli");
+      wallet_args.add("--daemon-address"); wallet_args.add("127.0.0.1:2222");
+      wallet_args.add("--wallet-file");    wallet_args.add("wallet_%d", wallet.id);
+      wallet_args.add("--password");       wallet_args.add("");
+      if (environment.daemon_param.nettype      == loki_nettype::testnet)  wallet_args.add("--testnet");
+      else if (environment.daemon_param.nettype == loki_nettype::stagenet) wallet_args.add("--stagenet");
+
+      std::string cmd_line = wallet_args.to_shell_cmd();
       loki_fixed_string<> file_name("./output/wallet_%d.sh", wallet.id);
-      if (!os_write_file(file_name.str, cmd_line.str, cmd_line.len))
+      if (!os_write_file(file_name.str, cmd_line.c_str(), static_cast<int>(cmd_line.size())) || !os_file_make_executable(file_name.str))
       {
-        fprintf(stderr, "Failed to create daemon launcher script file: %s\n", file_name.str);
-        return false;
+        fprintf(stderr, "Failed to create wallet launcher script file: %s\n", file_name.str);
+        return 1;
       }
     }
 
-    os_launch_process("chmod +x ./output/daemon_*.sh");
-    os_launch_process("chmod +x ./output/wallet_*.sh");
-    return true;
+    std::string manifest = loki_fixed_string<512>("num_blocks=%d\nheight=%llu\nservice_nodes=%d\ndaemons=%d\nwallets=%d\nwallet_balance=%d\nfixed_difficulty=%d\nnettype=%d\n",
+                                                  num_blocks,
+                                                  static_cast<unsigned long long>(height),
+                                                  num_service_nodes,
+                                                  num_daemons,
+                                                  num_wallets,
+                                                  initial_wallet_balance,
+                                                  fixed_difficulty,
+                                                  static_cast<int>(environment.daemon_param.nettype)).str;
+    if (helper_deterministic_wallets)
+      manifest += loki_fixed_string<64>("wallet_seed=%llu\n", static_cast<unsigned long long>(helper_wallet_seed)).str;
+    LOKI_FOR_EACH(wallet_index, environment.wallets.size())
+      manifest += loki_fixed_string<256>("wallet_%d=%s\n", environment.wallets[wallet_index].id, environment.wallets_addr[wallet_index].buf.str).str;
+
+    loki_fixed_string<256> manifest_path("%s/manifest", global_state.output_dir.str);
+    if (!os_write_file(manifest_path.str, manifest.c_str(), static_cast<int>(manifest.size())))
+    {
+      fprintf(stderr, "Failed to write the blockchain manifest: %s\n", manifest_path.str);
+      return 1;
+    }
+
+    return write_blockchain_archive(global_state.output_dir.str) ? 0 : 1;
+  }
+
+  itest_run_options run_options = {};
+  if (!parse_run_options(argc, argv, &run_options))
+  {
+    print_help();
+    return 1;
+  }
+
+  if (run_options.list)
+  {
+    print_scenarios(&run_options);
+    return 0;
   }
 
+  if (run_options.shard_count > 1)
+    itest_use_shard(run_options.shard_index);
+
+  helper_fixture_cache_enabled = run_options.fixture_cache;
+  helper_deterministic_wallets = run_options.deterministic_wallets;
+  helper_wallet_seed           = run_options.wallet_seed;
+  os_ignore_broken_pipe(); // NOTE: The watchdog kills processes whose pipes are still being written to
+  os_catch_interrupt();    // NOTE: Ctrl-C stops the run and tears down every process instead of orphaning them
   delete_old_blockchain_files();
+  os_file_dir_make(global_state.output_dir.str);
   printf("\n");
 #if 1
   int const NUM_THREADS = LOKI_MIN((int)std::thread::hardware_concurrency(), 16);
@@ -796,62 +2891,143 @@ int main(int argc, char **argv)
 #endif
 
   auto start_time = std::chrono::high_resolution_clock::now();
-#if 1
-  global_work_queue.jobs.push_back(latest__checkpointing__deregister_non_participating_peer);
-  global_work_queue.jobs.push_back(latest__checkpointing__new_peer_syncs_checkpoints);
-  global_work_queue.jobs.push_back(latest__checkpointing__private_chain_reorgs_to_checkpoint_chain);
+  for (itest_scenario_info const &info : itest_scenario_registry())
+  {
+    if (!info.disabled && scenario_selected(&info, &run_options))
+      global_work_queue.add(&info);
+  }
+
+  if (global_work_queue.jobs.empty())
+  {
+    fprintf(stderr, "No scenarios matched the filters, see --list\n");
+    return 1;
+  }
 
-  // NOTE(doyle): Doesn't work
-  // global_work_queue.jobs.push_back(latest__decommission__recommission_on_uptime_proof);
+  // NOTE: Isolated workers run a single scenario per fork, a shared fixture would have to outlive it
+  if (run_options.isolate || !run_options.share_fixture)
+  {
+    for (itest_job &job : global_work_queue.jobs)
+      job.shares_fixture = false;
+  }
 
-  global_work_queue.jobs.push_back(latest__deregistration__n_unresponsive_node);
+  os_cpu_set harness_cpus = {};
+  int first_scenario_cpu  = 0;
+  int num_scenario_cpus   = 0;
+  if (run_options.pin_cpus)
+  {
+    int const num_cpus = os_num_cpus();
+    if (run_options.harness_cpus >= num_cpus)
+    {
+      fprintf(stderr, "Harness CPUs: %d must leave some of the %d CPUs for scenarios, not isolating the harness\n", run_options.harness_cpus, num_cpus);
+      run_options.harness_cpus = 0;
+    }
 
-  global_work_queue.jobs.push_back(latest__prepare_registration__check_100_percent_operator_cut_stake);
-  global_work_queue.jobs.push_back(latest__prepare_registration__check_all_solo_stake_forms_valid_registration);
-  global_work_queue.jobs.push_back(latest__prepare_registration__check_solo_stake);
+    harness_cpus       = {0, run_options.harness_cpus};
+    first_scenario_cpu = run_options.harness_cpus;
+    num_scenario_cpus  = num_cpus - run_options.harness_cpus;
+    os_set_thread_affinity(harness_cpus);
 
-  global_work_queue.jobs.push_back(latest__print_locked_stakes__check_no_locked_stakes);
-  global_work_queue.jobs.push_back(latest__print_locked_stakes__check_shows_locked_stakes);
+    global_work_queue.first_scenario_cpu = first_scenario_cpu;
+    global_work_queue.cpu_load.assign(num_scenario_cpus, 0.f);
+    printf("Pinning scenarios to CPUs sized by their budget out of %d, harness isolated on %d CPU(s)\n\n", num_cpus, harness_cpus.count);
+  }
 
-  global_work_queue.jobs.push_back(latest__register_service_node__allow_43_23_13_21_reserved_contribution);
-  global_work_queue.jobs.push_back(latest__register_service_node__allow_4_stakers);
-  global_work_queue.jobs.push_back(latest__register_service_node__allow_70_20_and_10_open_for_contribution);
-  global_work_queue.jobs.push_back(latest__register_service_node__allow_87_13_contribution);
-  global_work_queue.jobs.push_back(latest__register_service_node__allow_87_13_reserved_contribution);
-  global_work_queue.jobs.push_back(latest__register_service_node__check_unlock_time_is_0);
-  global_work_queue.jobs.push_back(latest__register_service_node__disallow_register_twice);
+  {
+    int const FDS_RESERVED_FOR_HARNESS = 64;
+    int const memory_mb                = os_memory_available_mb();
+    int const max_fds                  = os_max_open_files();
+
+    itest_resource_budget *budget = &global_work_queue.available;
+    budget->cpus                  = static_cast<float>(num_scenario_cpus ? num_scenario_cpus : os_num_cpus());
+    budget->memory_mb             = (memory_mb == -1) ? INT32_MAX : memory_mb;
+    budget->fds                   = (max_fds == -1)   ? INT32_MAX : LOKI_MAX(max_fds - FDS_RESERVED_FOR_HARNESS, 0);
+    printf("Scheduling scenarios against %.0f CPU(s), %dMB of memory and %d fds\n\n", budget->cpus, memory_mb, max_fds);
+  }
 
-  global_work_queue.jobs.push_back(latest__request_stake_unlock__check_pooled_stake_unlocked);
-  global_work_queue.jobs.push_back(latest__request_stake_unlock__check_unlock_height);
-  global_work_queue.jobs.push_back(latest__request_stake_unlock__disallow_request_on_non_existent_node);
-  global_work_queue.jobs.push_back(latest__request_stake_unlock__disallow_request_twice);
+  if (run_options.shard_count > 1)
+  {
+    itest_history shard_history;
+    if (run_options.shard_history)
+    {
+      shard_history = load_history(run_options.shard_history);
+      if (shard_history.empty())
+        fprintf(stderr, "Shard history %s is missing or empty, balancing every scenario as the same duration\n", run_options.shard_history);
+    }
 
-  global_work_queue.jobs.push_back(latest__stake__allow_incremental_stakes_with_1_contributor);
-  global_work_queue.jobs.push_back(latest__stake__check_incremental_stakes_decreasing_min_contribution);
-  global_work_queue.jobs.push_back(latest__stake__check_transfer_doesnt_used_locked_key_images);
-  global_work_queue.jobs.push_back(latest__stake__disallow_staking_less_than_minimum_in_pooled_node);
-  global_work_queue.jobs.push_back(latest__stake__disallow_staking_when_all_amounts_reserved);
-  global_work_queue.jobs.push_back(latest__stake__disallow_to_non_registered_node);
+    keep_shard_jobs(&global_work_queue.jobs, run_options.shard_index, run_options.shard_count, shard_history);
+    printf("Running shard %d/%d with %zu scenario(s), output in %s\n\n", run_options.shard_index + 1, run_options.shard_count, global_work_queue.jobs.size(), global_state.output_dir.str);
+  }
 
-  global_work_queue.jobs.push_back(latest__transfer__check_fee_amount_80x_increase);
+  // NOTE: The local history only orders this run's jobs, it never decides which shard runs what
+  itest_history history = load_history(ITEST_HISTORY_FILE);
+  order_longest_expected_first(&global_work_queue.jobs, history);
 
-  global_work_queue.jobs.push_back(v11__transfer__check_fee_amount_bulletproofs);
-#else
-  // global_work_queue.jobs.push_back(latest__decommission__recommission_on_uptime_proof);
-#endif
+  global_work_queue.max_retries = run_options.retries;
+  global_work_queue.fail_fast   = run_options.fail_fast;
+  {
+    // NOTE: Start at half the threads and let the controller grow it, pressure shows up too late to
+    // stop every thread from launching its daemons at once
+    itest_admission_controller *admission = &global_work_queue.admission;
+    admission->enabled                    = run_options.admission;
+    admission->max_limit                  = LOKI_MAX(static_cast<int>(global_work_queue.jobs.size()), 1);
+    admission->limit                      = LOKI_MAX(NUM_THREADS / 2, 1);
+  }
+  if (run_options.quarantine)
+    quarantine_chronic_flakes(&global_work_queue.jobs, load_flake_ledger(ITEST_FLAKE_LEDGER_FILE));
 
-  std::vector<std::thread> threads;
-  threads.reserve(NUM_THREADS);
+  if (run_options.isolate)
+  {
+    // NOTE: Nothing in the parent may start a thread before this, the workers are forked from it
+    run_isolated_workers(NUM_THREADS, harness_cpus);
+  }
+  else
+  {
+    std::vector<std::thread> threads;
+    threads.reserve(NUM_THREADS);
 
-  for (int i = 0; i < NUM_THREADS; ++i)
-    threads.push_back(std::thread(thread_to_task_dispatcher));
+    for (int i = 0; i < NUM_THREADS; ++i)
+      threads.push_back(std::thread(thread_to_task_dispatcher, harness_cpus));
 
-  for (int i = 0; i < NUM_THREADS; ++i)
-    threads[i].join();
+    std::thread watchdog(thread_to_watchdog, harness_cpus);
+    for (int i = 0; i < NUM_THREADS; ++i)
+      threads[i].join();
+    watchdog.join();
+  }
 
   auto end_time = std::chrono::high_resolution_clock::now();
   auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
   printf("\nTests passed %zu/%zu (using %d threads) in %5.2fs\n\n", global_work_queue.num_jobs_succeeded.load(), global_work_queue.jobs.size(), NUM_THREADS, duration / 1000.f);
+  print_parallel_efficiency(global_work_queue.jobs, NUM_THREADS, duration / 1000.f);
+  helper_print_sync_metrics();
+
+  if (global_work_queue.stopping)
+    printf("Stopped early (%s), %zu scenario(s) were not run\n", global_work_queue.stop_reason.str, global_work_queue.jobs.size() - global_work_queue.num_jobs_started);
+
+  size_t num_quarantined_failures = 0;
+  for (itest_job const &job : global_work_queue.jobs)
+  {
+    if (job.started && job.attempts > 1 && !job.result.failed)
+      printf("Flaky: %s passed on attempt %d\n", job.name, job.attempts);
+    if (job.started && job.result.failed && job.quarantined)
+    {
+      printf("Quarantined: %s failed but doesn't fail the run\n", job.name);
+      num_quarantined_failures++;
+    }
+  }
 
-  return 0;
+  itest_flake_ledger flake_ledger = load_flake_ledger(ITEST_FLAKE_LEDGER_FILE); // NOTE: Reload, co-located shards share the file
+  update_flake_ledger(&flake_ledger, global_work_queue.jobs);
+  if (!save_flake_ledger(ITEST_FLAKE_LEDGER_FILE, flake_ledger))
+    fprintf(stderr, "Failed to write flake ledger to %s\n", ITEST_FLAKE_LEDGER_FILE);
+
+  history = load_history(ITEST_HISTORY_FILE); // NOTE: Reload, co-located shards share the file
+  update_history(&history, global_work_queue.jobs);
+  if (!save_history(ITEST_HISTORY_FILE, history))
+    fprintf(stderr, "Failed to write scenario history to %s\n", ITEST_HISTORY_FILE);
+
+  if (run_options.results_file && !write_results_file(run_options.results_file, global_work_queue.jobs))
+    fprintf(stderr, "Failed to write results to %s\n", run_options.results_file);
+
+  int result = (global_work_queue.num_jobs_succeeded + num_quarantined_failures == global_work_queue.jobs.size()) ? 0 : 1;
+  return result;
 }
@@ -6,6 +6,8 @@
 #include <string.h>
 #include <assert.h>
 #include <string>
+#include <vector>
+#include <future>
 
 #include "external/stb_sprintf.h"
 
@@ -73,6 +75,8 @@ struct loki_defer_helper_
 #define LOKI_TOKEN_COMBINE2(a, b) a ## b
 #define LOKI_DEFER const auto LOKI_TOKEN_COMBINE(defer_lambda_, __COUNTER__) = loki_defer_helper_() + [&]()
 
+#include "loki_async.h"
+
 // -------------------------------------------------------------------------------------------------
 //
 // strings
@@ -136,6 +140,24 @@ struct loki_fixed_string
   int  len;
 };
 
+// -------------------------------------------------------------------------------------------------
+//
+// itest_launch_args
+//
+// -------------------------------------------------------------------------------------------------
+// NOTE: The argv of a process to launch. Each argument is passed directly to exec, there's no shell
+// in between so arguments are never quoted and there's no limit on the length of the command line.
+struct itest_launch_args
+{
+  std::vector<std::string> args;
+
+  void        add         (char const *fmt, ...); // Appends exactly one argument
+  void        add_cmd_line(char const *cmd_line); // Appends each argument of a command line, split and unquoted like a shell would
+  std::string to_shell_cmd() const;               // Quoted for writing into shell scripts, not for launching
+};
+
+void itest_kill_process(int pid); // Kills a daemon or wallet the harness launched and everything it started
+
 // -------------------------------------------------------------------------------------------------
 //
 // itest_ipc
@@ -182,6 +204,16 @@ itest_read_result itest_read_stdout                 (itest_ipc *ipc);
 itest_read_result itest_read_stdout_until           (itest_ipc *ipc, char const *find_str);
 itest_read_result itest_read_stdout_until           (itest_ipc *ipc, itest_read_possible_value const *possible_values, int possible_values_len);
 void              itest_read_until_then_write_stdin (itest_ipc *ipc, loki_string find_str, char const *src);
+void              itest_sleep_ms                    (int ms); // Unlike os_sleep_ms, wakes up early if the scenario is timed out
+
+// NOTE: Awaitable versions of the above for coroutines, the blocking functions wait on these. Pointers
+// passed in must outlive the task.
+itest_task<void>              itest_write_to_stdin_async              (itest_ipc *ipc, char const *src);
+itest_task<itest_read_result> itest_read_stdout_async                 (itest_ipc *ipc);
+itest_task<itest_read_result> itest_read_stdout_until_async           (itest_ipc *ipc, char const *find_str);
+itest_task<itest_read_result> itest_read_stdout_until_async           (itest_ipc *ipc, itest_read_possible_value const *possible_values, int possible_values_len);
+itest_task<itest_read_result> itest_write_then_read_stdout_until_async(itest_ipc *ipc, char const *src, loki_string find_str);
+itest_task<itest_read_result> itest_write_then_read_stdout_until_async(itest_ipc *ipc, char const *src, itest_read_possible_value const *possible_values, int possible_values_len);
 
 // -------------------------------------------------------------------------------------------------
 //
@@ -206,6 +238,14 @@ const int      LOKI_VOTE_LIFETIME                           = 60;
 const int      LOKI_CHECKPOINT_INTERVAL                     = 4;
 const int      LOKI_DECOMMISSION_INITIAL_CREDIT             = 60;
 
+// NOTE: Plans how many blocks to mine from the emission schedule, so helpers can mine what they need
+// in one go instead of polling the wallet between batches. Heights are chain heights as reported by
+// the daemon's status, i.e. the next block mined is at that height. Amounts are in atomic units.
+uint64_t loki_miner_reward                 (uint64_t height);                           // Lower bound, excludes fees
+uint64_t loki_blocks_until_mined_reward    (uint64_t height, uint64_t atomic_amount);  // Blocks whose coinbase adds up to atomic_amount
+uint64_t loki_blocks_until_unlocked_reward (uint64_t height, uint64_t atomic_amount);  // As above plus the unlock window, so it's spendable
+uint64_t loki_blocks_until_height          (uint64_t height, uint64_t min_height);
+
 using loki_key_image                                        = loki_fixed_string<64  + 1>;
 using loki_transaction_id                                   = loki_fixed_string<64  + 1>;
 using loki_snode_key                                        = loki_fixed_string<64  + 1>;
@@ -267,7 +307,8 @@ struct start_daemon_params
   int                     num_hardforks;
   loki_nettype            nettype = loki_nettype::testnet;
   bool                    keep_terminal_open;
-  loki_fixed_string<2048> custom_cmd_line;
+  loki_fixed_string<2048> custom_cmd_line;      // Extra daemon arguments, quoted like a shell command line
+  loki_fixed_string<256>  template_data_dir;    // Data dir of a stopped daemon, cloned copy-on-write so the daemon starts with its chain
 
   void add_hardfork                          (int version, int height); // TODO: Sets daemon mode to fakechain sadly, can't keep testnet. We should fix this
   void add_sequential_hardforks_until_version(int version);
@@ -276,7 +317,7 @@ struct start_daemon_params
 
 struct daemon_t
 {
-  FILE     *proc_handle;
+  int       pid;
   int       id;
   bool      is_mining;
   int       p2p_port;
@@ -286,10 +327,37 @@ struct daemon_t
   itest_ipc ipc;
 };
 
-daemon_t create_daemon                 ();
-void     start_daemon                  (daemon_t *daemons, int num_daemons, start_daemon_params *params, int num_params, char const *terminal_name);
-daemon_t create_and_start_daemon       (start_daemon_params params, char const *terminal_name);
-void     create_and_start_multi_daemons(daemon_t *daemons, int num_daemons, start_daemon_params *params, int num_params, char const *terminal_name);
+// NOTE: Everything needed to build a daemon's command line. Shared between launching daemons and
+// writing out the launch scripts for generated blockchains.
+struct daemon_launch_spec
+{
+  daemon_t const         *daemon;
+  start_daemon_params     params;
+  loki_fixed_string<256>  data_dir;
+  bool                    integration_test_mode = true; // Pipe name and hardfork overrides, only understood by integration binaries
+  bool                    offline;
+  int                     log_level             = -1;   // Set to -1 to use the daemon's default
+  int                     storage_server_port   = 4444; // Set to 0 to leave out the storage server port and public ip
+  std::vector<int>        exclusive_node_ports;
+
+  void              add_exclusive_nodes(daemon_t const *peers, int num_peers); // Skips the daemon the spec is for
+  itest_launch_args build() const;
+};
+
+// NOTE: Startup readiness. Launching returns straight away with one future per process, the future
+// completes once the process has connected to its end of the IPC channel and signalled it's ready.
+// For the daemon that's answering its first status request, for the wallet it's the startup balance
+// its command loop prints. Whatever is passed in by pointer must outlive the futures.
+typedef std::vector<std::future<void>> itest_ready_futures;
+void             itest_wait_until_ready      (itest_ready_futures *futures);
+itest_task<void> itest_wait_until_ready_async(itest_ready_futures *futures);
+
+daemon_t               create_daemon                 ();
+loki_fixed_string<256> daemon_data_dir               (daemon_t const *daemon);
+itest_ready_futures    start_daemon_async            (daemon_t *daemons, int num_daemons, start_daemon_params *params, int num_params, char const *terminal_name);
+void                   start_daemon                  (daemon_t *daemons, int num_daemons, start_daemon_params *params, int num_params, char const *terminal_name);
+daemon_t               create_and_start_daemon       (start_daemon_params params, char const *terminal_name);
+void                   create_and_start_multi_daemons(daemon_t *daemons, int num_daemons, start_daemon_params *params, int num_params, char const *terminal_name);
 
 // -------------------------------------------------------------------------------------------------
 //
@@ -298,14 +366,16 @@ void     create_and_start_multi_daemons(daemon_t *daemons, int num_daemons, star
 // -------------------------------------------------------------------------------------------------
 struct start_wallet_params
 {
-  daemon_t *daemon                          = nullptr;
-  bool      allow_mismatched_daemon_version = false;
-  bool      keep_terminal_open;
+  daemon_t              *daemon                          = nullptr;
+  bool                   allow_mismatched_daemon_version = false;
+  bool                   keep_terminal_open;
+  loki_fixed_string<256> wallet_file; // Open a copy of this existing wallet instead of generating a new one
+  loki_hash64            spend_key;   // Generate the wallet from this secret spend key (hex) instead of random keys
 };
 
 struct wallet_t
 {
-  FILE         *proc_handle;
+  int           pid;
   int           id;
   loki_nettype  nettype;
   uint64_t      balance;
@@ -317,6 +387,8 @@ struct wallet_t
 // separately to create on the commandline and immediately exits. Then launches
 // again for the start part. This is wasteful, we can speed up tests by making
 // it just reuse the same instance it did for creating.
-wallet_t create_and_start_wallet(loki_nettype nettype, start_wallet_params params, char const *terminal_name);
+wallet_t          create_and_start_wallet      (loki_nettype nettype, start_wallet_params params, char const *terminal_name);
+std::future<void> create_and_start_wallet_async(wallet_t *wallet, loki_nettype nettype, start_wallet_params params, char const *terminal_name);
+loki_fixed_string<256> wallet_file_path(wallet_t const *wallet); // The keys file is this path with .keys appended
 
 #endif // LOKI_INTEGRATION_TEST_H
@@ -1,8 +1,28 @@
 #ifndef LOKI_OS_H
 #define LOKI_OS_H
 
-void  os_kill_process  (FILE *process); // TODO(loki): This doesn't work. But we don't use it right now, so thats ok
-FILE *os_launch_process(char const *cmd_line);
+// NOTE: A contiguous range of the CPUs this process was allowed to run on at startup, i.e. index 0 is
+// the first CPU available to us which is not necessarily CPU 0 when running under a cpuset.
+struct os_cpu_set
+{
+  int first;
+  int count; // Set to 0 to leave the affinity unrestricted
+};
+
+void  os_kill_process       (int pid);
+void  os_kill_process_group (int pgid);                                  // Kills every process in the group led by pgid
+FILE *os_launch_process     (char const *cmd_line);                      // Runs cmd_line through the shell
+int   os_spawn_process      (char const *const *argv, os_cpu_set cpus = {}, bool new_process_group = false, char const *output_path = nullptr); // argv is null terminated and exec'ed directly, returns the pid or -1. A new group's pgid is the pid, output_path receives stdout and stderr
+int   os_num_cpus           ();                                          // Call once before pinning any threads, the startup affinity is cached
+bool  os_set_thread_affinity(os_cpu_set cpus);
+int   os_memory_available_mb();                                          // Memory that can be allocated without swapping, -1 if unknown
+int   os_max_open_files     ();                                          // Per-process file descriptor limit, -1 if unknown
+float os_load_average       ();                                          // Runnable tasks averaged over the last minute, -1 if unknown
+float os_pressure_stall     (char const *resource);                      // % of the last 10s some task stalled on "cpu", "memory" or "io", -1 without PSI
+bool  os_wait_for_process_exit(int pid, int timeout_ms);                // Reaps the process, pid must be a child of ours
+void  os_ignore_broken_pipe ();                                          // Writing to a pipe whose reader died fails with EPIPE instead of killing us
+void  os_catch_interrupt    ();                                          // The first SIGINT only sets os_interrupted, a second one kills us as usual
+bool  os_interrupted        ();
 void  os_sleep_s       (int seconds);
 void  os_sleep_ms      (int ms);
 
@@ -16,8 +36,11 @@ struct os_file_info
 bool  os_file_delete    (char const *path);
 bool  os_file_dir_delete(char const *path);
 bool  os_file_dir_make  (char const *path);
+bool  os_file_clone     (char const *src, char const *dest); // Copy-on-write where the filesystem supports it
+bool  os_file_dir_clone (char const *src, char const *dest, char const *const *skip_names = nullptr, int num_skip_names = 0); // Copy-on-write where the filesystem supports it, skip_names are file names (not paths) to leave out
 bool  os_file_exists    (char const *path, os_file_info *info = nullptr);
 bool  os_write_file     (char const *path, char const *buf, int buf_len);
+bool  os_file_make_executable(char const *path); // Sets rwxr-xr-x exactly, independent of the umask
 
 #if defined(LOKI_OS_IMPLEMENTATION)
 #if defined(_WIN32)
@@ -25,23 +48,39 @@ bool  os_write_file     (char const *path, char const *buf, int buf_len);
   #define NOMINMAX
   #include <Windows.h>
 #else
+  #include <sched.h>      // sched_setaffinity
   #include <sys/types.h>  // mkdir mode typedefs
   #include <sys/stat.h>   // unlink, semaphore
   #include <sys/unistd.h> // rmdir
   #include <fcntl.h>      // semaphore
   #include <semaphore.h>
   #include <ftw.h>        // nftw
+  #include <signal.h>     // kill
+  #include <sys/wait.h>   // waitpid
+  #include <sys/resource.h> // getrlimit
+  #include <dirent.h>     // opendir, readdir
+  #include <sys/ioctl.h>  // ioctl
+  #include <linux/fs.h>   // FICLONE
 #endif
 
 #include <chrono>
 #include <thread>
 
-void os_kill_process(FILE *process)
+void os_kill_process(int pid)
 {
 #ifdef _WIN32
-  _pclose(process);
+#error "Please implement"
 #else
-  pclose(process);
+  if (pid > 0) kill(pid, SIGKILL);
+#endif
+}
+
+void os_kill_process_group(int pgid)
+{
+#ifdef _WIN32
+#error "Please implement"
+#else
+  if (pgid > 0) kill(-pgid, SIGKILL);
 #endif
 }
 
@@ -56,6 +95,227 @@ FILE *os_launch_process(char const *cmd_line)
   return result;
 }
 
+#if !defined(_WIN32)
+FILE_SCOPE cpu_set_t const *os_startup_affinity_()
+{
+  LOCAL_PERSIST cpu_set_t const result = []() {
+    cpu_set_t set = {};
+    if (sched_getaffinity(0, sizeof(set), &set) == -1)
+    {
+      perror("Failed to query the process CPU affinity");
+      for (int cpu = 0; cpu < (int)std::thread::hardware_concurrency(); cpu++) CPU_SET(cpu, &set);
+    }
+    return set;
+  }();
+  return &result;
+}
+
+FILE_SCOPE cpu_set_t os_cpu_set_to_native_(os_cpu_set cpus)
+{
+  cpu_set_t const *available = os_startup_affinity_();
+  cpu_set_t result           = {};
+  for (int cpu = 0, index = 0; cpu < CPU_SETSIZE; cpu++)
+  {
+    if (!CPU_ISSET(cpu, available)) continue;
+    if (index >= cpus.first && index < cpus.first + cpus.count) CPU_SET(cpu, &result);
+    index++;
+  }
+
+  if (CPU_COUNT(&result) == 0) result = *available; // NOTE: Range was out of bounds, don't restrict
+  return result;
+}
+#endif
+
+int os_num_cpus()
+{
+#ifdef _WIN32
+  int result = static_cast<int>(std::thread::hardware_concurrency());
+#else
+  int result = CPU_COUNT(os_startup_affinity_());
+#endif
+  return result;
+}
+
+bool os_set_thread_affinity(os_cpu_set cpus)
+{
+  if (cpus.count <= 0) return true;
+#ifdef _WIN32
+#error "Please implement"
+#else
+  cpu_set_t set = os_cpu_set_to_native_(cpus);
+  bool result   = (sched_setaffinity(0, sizeof(set), &set) == 0);
+  if (!result) perror("Failed to set thread CPU affinity");
+  return result;
+#endif
+}
+
+int os_spawn_process(char const *const *argv, os_cpu_set cpus, bool new_process_group, char const *output_path)
+{
+#ifdef _WIN32
+#error "Please implement"
+#else
+  cpu_set_t set = (cpus.count > 0) ? os_cpu_set_to_native_(cpus) : cpu_set_t{};
+  int result    = fork();
+  if (result == 0)
+  {
+    // NOTE: Only async-signal-safe calls from here on, the harness is multi-threaded
+    if (new_process_group) setpgid(0, 0);
+    if (cpus.count > 0) sched_setaffinity(0, sizeof(set), &set);
+    if (output_path)
+    {
+      int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd != -1)
+      {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+      }
+    }
+    execvp(argv[0], const_cast<char *const *>(argv));
+    _exit(127);
+  }
+
+  if (result == -1)
+    perror("Failed to fork process");
+  else if (new_process_group)
+    setpgid(result, result); // NOTE: Also from the parent, the group must exist before we return and someone kills it
+  return result;
+#endif
+}
+
+int os_memory_available_mb()
+{
+#ifdef _WIN32
+#error "Please implement"
+#else
+  int result = -1;
+  FILE *file = fopen("/proc/meminfo", "r");
+  if (!file) return result;
+
+  char line[256];
+  while (fgets(line, sizeof(line), file))
+  {
+    long long kb = 0;
+    if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1)
+    {
+      result = static_cast<int>(kb / 1024);
+      break;
+    }
+  }
+
+  fclose(file);
+  return result;
+#endif
+}
+
+int os_max_open_files()
+{
+#ifdef _WIN32
+#error "Please implement"
+#else
+  rlimit limit = {};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == RLIM_INFINITY)
+    return -1;
+  int result = static_cast<int>(LOKI_MIN(limit.rlim_cur, static_cast<rlim_t>(INT32_MAX)));
+  return result;
+#endif
+}
+
+float os_load_average()
+{
+#ifdef _WIN32
+#error "Please implement"
+#else
+  float result = -1.f;
+  FILE *file   = fopen("/proc/loadavg", "r");
+  if (!file) return result;
+  if (fscanf(file, "%f", &result) != 1) result = -1.f;
+  fclose(file);
+  return result;
+#endif
+}
+
+float os_pressure_stall(char const *resource)
+{
+#ifdef _WIN32
+#error "Please implement"
+#else
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+
+  float result = -1.f;
+  FILE *file   = fopen(path, "r");
+  if (!file) return result;
+
+  // NOTE: i.e. some avg10=1.23 avg60=0.50 avg300=0.10 total=12345
+  char line[256];
+  while (fgets(line, sizeof(line), file))
+  {
+    if (sscanf(line, "some avg10=%f", &result) == 1)
+      break;
+  }
+
+  fclose(file);
+  return result;
+#endif
+}
+
+bool os_wait_for_process_exit(int pid, int timeout_ms)
+{
+#ifdef _WIN32
+#error "Please implement"
+#else
+  if (pid <= 0) return false;
+  int const SLEEP_MS = 50;
+  for (int waited_ms = 0;; waited_ms += SLEEP_MS)
+  {
+    int status  = 0;
+    pid_t state = waitpid(pid, &status, WNOHANG);
+    if (state == pid)                               return true;
+    if (state == -1)                                return errno == ECHILD; // NOTE: Already reaped
+    if (timeout_ms >= 0 && waited_ms >= timeout_ms) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(SLEEP_MS));
+  }
+#endif
+}
+
+void os_ignore_broken_pipe()
+{
+#ifdef _WIN32
+#error "Please implement"
+#else
+  signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+#ifndef _WIN32
+static volatile sig_atomic_t os_interrupted_;
+static void os_on_interrupt_(int) { os_interrupted_ = 1; }
+#endif
+
+void os_catch_interrupt()
+{
+#ifdef _WIN32
+#error "Please implement"
+#else
+  struct sigaction action = {};
+  action.sa_handler       = os_on_interrupt_;
+  action.sa_flags         = SA_RESTART | SA_RESETHAND;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+#endif
+}
+
+bool os_interrupted()
+{
+#ifdef _WIN32
+#error "Please implement"
+#else
+  bool result = os_interrupted_;
+  return result;
+#endif
+}
+
 void os_sleep_s(int seconds)
 {
   std::this_thread::sleep_for(std::chrono::milliseconds(seconds * 1000));
@@ -105,6 +365,141 @@ bool os_file_dir_make(char const *path)
 #endif
 }
 
+#if !defined(_WIN32)
+FILE_SCOPE bool os_file_clone_(char const *src, char const *dest, mode_t mode)
+{
+  int src_fd = open(src, O_RDONLY);
+  if (src_fd == -1)
+  {
+    perror(src);
+    return false;
+  }
+
+  int dest_fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  if (dest_fd == -1)
+  {
+    perror(dest);
+    close(src_fd);
+    return false;
+  }
+
+  bool result = false;
+#if defined(FICLONE)
+  result = (ioctl(dest_fd, FICLONE, src_fd) == 0); // NOTE: Reflink, shares extents until either side writes
+#endif
+
+  if (!result)
+  {
+    // NOTE: Filesystem can't share extents, copy_file_range still keeps the data in the kernel and
+    // some filesystems will clone on our behalf. Whatever it couldn't copy falls through to read/write.
+    for (;;)
+    {
+      ssize_t bytes_copied = copy_file_range(src_fd, nullptr, dest_fd, nullptr, 1 << 30, 0);
+      if (bytes_copied <= 0) break;
+    }
+
+    result = true;
+    char buf[64 * 1024];
+    for (ssize_t bytes_read = 0; result && (bytes_read = read(src_fd, buf, sizeof(buf))) != 0;)
+    {
+      if (bytes_read == -1)
+      {
+        result = false;
+        break;
+      }
+
+      for (ssize_t bytes_written = 0; bytes_written < bytes_read;)
+      {
+        ssize_t written = write(dest_fd, buf + bytes_written, bytes_read - bytes_written);
+        if (written == -1)
+        {
+          result = false;
+          break;
+        }
+        bytes_written += written;
+      }
+    }
+
+    if (!result) perror(dest);
+  }
+
+  close(src_fd);
+  close(dest_fd);
+  return result;
+}
+#endif
+
+bool os_file_clone(char const *src, char const *dest)
+{
+#if defined(_WIN32)
+#error "Please implement"
+#else
+  struct stat src_stat = {};
+  if (stat(src, &src_stat) == -1 || !S_ISREG(src_stat.st_mode))
+    return false;
+
+  bool result = os_file_clone_(src, dest, src_stat.st_mode & 07777);
+  return result;
+#endif
+}
+
+bool os_file_dir_clone(char const *src, char const *dest, char const *const *skip_names, int num_skip_names)
+{
+#if defined(_WIN32)
+#error "Please implement"
+#else
+  struct stat src_stat = {};
+  if (stat(src, &src_stat) == -1 || !S_ISDIR(src_stat.st_mode))
+    return false;
+
+  if (mkdir(dest, src_stat.st_mode & 07777) == -1 && errno != EEXIST)
+  {
+    perror(dest);
+    return false;
+  }
+
+  DIR *dir = opendir(src);
+  if (!dir)
+  {
+    perror(src);
+    return false;
+  }
+
+  bool result = true;
+  for (dirent *entry = readdir(dir); result && entry; entry = readdir(dir))
+  {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+
+    bool skip = false;
+    for (int i = 0; i < num_skip_names && !skip; i++)
+      skip = (strcmp(entry->d_name, skip_names[i]) == 0);
+    if (skip) continue;
+
+    std::string src_path  = std::string(src)  + "/" + entry->d_name;
+    std::string dest_path = std::string(dest) + "/" + entry->d_name;
+
+    struct stat entry_stat = {};
+    if (lstat(src_path.c_str(), &entry_stat) == -1)
+    {
+      perror(src_path.c_str());
+      result = false;
+    }
+    else if (S_ISDIR(entry_stat.st_mode))
+    {
+      result = os_file_dir_clone(src_path.c_str(), dest_path.c_str(), skip_names, num_skip_names);
+    }
+    else if (S_ISREG(entry_stat.st_mode))
+    {
+      result = os_file_clone_(src_path.c_str(), dest_path.c_str(), entry_stat.st_mode & 07777);
+    }
+  }
+
+  closedir(dir);
+  return result;
+#endif
+}
+
 bool os_file_exists(char const *path, os_file_info *info)
 {
 #if defined(_WIN32)
@@ -165,5 +560,16 @@ bool os_write_file(char const *path, char const *buf, int buf_len)
   return true;
 }
 
+bool os_file_make_executable(char const *path)
+{
+#ifdef _WIN32
+  (void)path;
+  return true;
+#else
+  bool result = chmod(path, 0755) == 0;
+  return result;
+#endif
+}
+
 #endif // LOKI_OS_IMPLEMENTATION
 #endif // LOKI_OS_H
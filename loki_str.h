@@ -145,14 +145,14 @@ char const *str_skip_to_next_alpha_char(char const *src)
 char const *str_skip_to_next_whitespace(char const *src)
 {
   char const *result = src;
-  while (result && !char_is_whitespace(result[0])) ++result;
+  while (result && result[0] && !char_is_whitespace(result[0])) ++result;
   return result;
 }
 
 char const *str_skip_to_next_whitespace_inplace(char const **src)
 {
   char const **result = src;
-  while (*result && !char_is_whitespace((*result)[0])) ++(*result);
+  while (*result && (*result)[0] && !char_is_whitespace((*result)[0])) ++(*result);
   return *result;
 }
 
@@ -49,26 +49,119 @@ char const *LOKI_MAINNET_ADDR[] = // Some fake addresses for use in tests
   "LEGbch6JYiUjX3ebUvVZZNiU2wNT3SBD4DZgGH9xN56VGq4obkGsKEF8zGLBXiNnFv5dzQX1Yg1Yx99YSgg4GDaZKw6zxcA",
 };
 
+static uint64_t helper_fnv1a_64(void const *bytes, size_t size, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    hash ^= static_cast<uint8_t const *>(bytes)[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static uint64_t helper_checkpoints_digest(std::vector<daemon_checkpoint> const &checkpoints)
+{
+  uint64_t result = helper_fnv1a_64(nullptr, 0);
+  for (daemon_checkpoint const &checkpoint : checkpoints)
+  {
+    result = helper_fnv1a_64(&checkpoint.height, sizeof(checkpoint.height), result);
+    result = helper_fnv1a_64(&checkpoint.service_node_checkpoint, sizeof(checkpoint.service_node_checkpoint), result);
+    result = helper_fnv1a_64(checkpoint.block_hash.str, checkpoint.block_hash.len, result);
+  }
+  return result;
+}
+
+// NOTE: Every daemon is queried at once and compared to daemon 0 by a digest of its checkpoints, sorted
+// by height so the order a daemon prints them in doesn't matter. The lists are only merged when the
+// digests differ, to report the first height the daemons disagree on.
 static bool helper_compare_checkpoints(daemon_t *daemons, int num_daemons)
 {
   bool result = true;
   if (num_daemons <= 1)
     return result;
 
-  std::vector<daemon_checkpoint> reference_checkpoints = daemon_print_checkpoints(daemons + 0);
+  std::vector<std::future<std::vector<daemon_checkpoint>>> queries;
+  queries.reserve(num_daemons);
+  LOKI_FOR_EACH(daemon_index, num_daemons)
+    queries.push_back(itest_async_future(daemon_print_checkpoints_async(daemons + daemon_index)));
+
+  std::vector<std::vector<daemon_checkpoint>> checkpoints = itest_async_get_all(&queries);
+  for (std::vector<daemon_checkpoint> &list : checkpoints)
+    std::stable_sort(list.begin(), list.end(), [](daemon_checkpoint const &lhs, daemon_checkpoint const &rhs) { return lhs.height < rhs.height; });
+
+  std::vector<daemon_checkpoint> const &reference = checkpoints[0];
+  uint64_t const reference_digest                 = helper_checkpoints_digest(reference);
   for (int daemon_index = 1; daemon_index < num_daemons; ++daemon_index)
   {
-    std::vector<daemon_checkpoint> checkpoints = daemon_print_checkpoints(daemons + daemon_index);
-    result &= reference_checkpoints == checkpoints;
+    std::vector<daemon_checkpoint> const &check = checkpoints[daemon_index];
+    if (helper_checkpoints_digest(check) == reference_digest)
+      continue;
+
+    // NOTE: Walk both lists by height, stop at the first height only one of them has or they disagree on
+    daemon_checkpoint const *expected = nullptr;
+    daemon_checkpoint const *actual   = nullptr;
+    for (size_t lhs_index = 0, rhs_index = 0; lhs_index < reference.size() || rhs_index < check.size();)
+    {
+      daemon_checkpoint const *lhs = (lhs_index < reference.size()) ? &reference[lhs_index] : nullptr;
+      daemon_checkpoint const *rhs = (rhs_index < check.size())     ? &check[rhs_index]     : nullptr;
+      if (lhs && rhs && lhs->height == rhs->height)
+      {
+        if (!(*lhs == *rhs))
+        {
+          expected = lhs;
+          actual   = rhs;
+          break;
+        }
+        lhs_index++;
+        rhs_index++;
+      }
+      else
+      {
+        if (!rhs || (lhs && lhs->height < rhs->height)) expected = lhs;
+        else                                            actual   = rhs;
+        break;
+      }
+    }
+
+    if (!expected && !actual)
+      continue;
+
+    result = false;
+    fprintf(stderr,
+            "Checkpoints diverge at height %zu, daemon_%d has %s, daemon_%d has %s\n",
+            expected ? expected->height : actual->height,
+            daemons[0].id,
+            expected ? expected->block_hash.str : "no checkpoint",
+            daemons[daemon_index].id,
+            actual ? actual->block_hash.str : "no checkpoint");
   }
 
   return result;
 }
 
+std::vector<itest_scenario_info> &itest_scenario_registry()
+{
+  LOCAL_PERSIST std::vector<itest_scenario_info> result;
+  return result;
+}
+
+bool itest_scenario_has_tag(itest_scenario_info const *info, char const *tag)
+{
+  size_t const tag_len = strlen(tag);
+  for (char const *ptr = str_skip_whitespace(info->tags); ptr[0]; ptr = str_skip_whitespace(ptr))
+  {
+    char const *end = str_skip_to_next_whitespace(ptr);
+    if (static_cast<size_t>(end - ptr) == tag_len && strncmp(ptr, tag, tag_len) == 0)
+      return true;
+    ptr = end;
+  }
+  return false;
+}
+
 void print_test_results(test_result const *test)
 {
   int const TARGET_LEN = 76;
-  char const *STATUS   = (test->failed) ? "FAILED" : "OK";
+  char const *STATUS   = (test->timed_out) ? "TIMEOUT" : (test->failed) ? "FAILED" : "OK";
 
 
   loki_fixed_string<> buf("%s ", test->name.str);
@@ -137,38 +230,78 @@ test_result helper_setup_blockchain_with_1_service_node(test_result const *conte
   return result;
 }
 
-void helper_block_until_blockchains_are_synced(daemon_t *daemons, int num_daemons)
+helper_sync_metrics helper_sync_stats;
+
+void helper_print_sync_metrics()
 {
-  if (num_daemons < 0)
+  int num_barriers = helper_sync_stats.num_barriers;
+  if (num_barriers == 0)
     return;
 
-  daemon_status_t target_status = {};
-  ptrdiff_t target_index = 0;
-  LOKI_FOR_EACH(i, num_daemons)
+  printf("Chain sync: %d barrier(s) took %.2fs in total, the longest %.2fs, %d timed out\n",
+         num_barriers,
+         helper_sync_stats.total_ms / 1000.f,
+         helper_sync_stats.max_ms / 1000.f,
+         helper_sync_stats.num_timeouts.load());
+}
+
+// NOTE: Every daemon is queried at once each round. The backoff between rounds starts at a few ms and
+// only grows while the chains aren't moving, it's reset whenever the highest tip advances.
+bool helper_block_until_blockchains_are_synced(daemon_t *daemons, int num_daemons, int timeout_ms)
+{
+  if (num_daemons <= 1)
+    return true;
+
+  int const MIN_BACKOFF_MS = 4;
+  int const MAX_BACKOFF_MS = 500;
+
+  auto start_time = std::chrono::steady_clock::now();
+  std::vector<daemon_chain_tip> tips(num_daemons);
+  uint64_t highest = 0;
+  int backoff_ms   = MIN_BACKOFF_MS;
+  bool result      = false;
+  for (;;)
   {
-    daemon_t *check_daemon      = daemons + i;
-    daemon_status_t check_status = daemon_status(check_daemon);
-    if (check_status.height > target_status.height)
-    {
-      target_index  = i;
-      target_status = check_status;
-    }
+    std::vector<std::future<daemon_chain_tip>> queries;
+    queries.reserve(num_daemons);
+    LOKI_FOR_EACH(daemon_index, num_daemons)
+      queries.push_back(itest_async_future(daemon_chain_tip_async(daemons + daemon_index)));
+
+    uint64_t round_highest = 0;
+    tips                   = itest_async_get_all(&queries);
+    for (daemon_chain_tip const &tip : tips)
+      round_highest = LOKI_MAX(round_highest, tip.height);
+
+    result = (tips[0].top_block_hash.len > 0);
+    for (daemon_chain_tip const &tip : tips)
+      result &= (tip == tips[0]);
+    if (result)
+      break;
+
+    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+    if (elapsed_ms >= timeout_ms)
+      break;
+
+    backoff_ms = (round_highest > highest) ? MIN_BACKOFF_MS : LOKI_MIN(backoff_ms * 2, MAX_BACKOFF_MS);
+    highest    = LOKI_MAX(highest, round_highest);
+    itest_sleep_ms(backoff_ms);
   }
 
-  LOKI_FOR_EACH(i, num_daemons)
-  {
-    if (i == target_index) continue;
-    daemon_t *check_daemon       = daemons + i;
-    daemon_status_t check_status = daemon_status(check_daemon);
+  uint64_t elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+  helper_sync_stats.num_barriers++;
+  helper_sync_stats.total_ms += elapsed_ms;
+  uint64_t max_ms = helper_sync_stats.max_ms;
+  while (elapsed_ms > max_ms && !helper_sync_stats.max_ms.compare_exchange_weak(max_ms, elapsed_ms)) {}
 
-    int wait_time = 1000;
-    while (check_status.height != target_status.height)
-    {
-      os_sleep_ms(LOKI_MIN(wait_time, 2000));
-      check_status = daemon_status(check_daemon);
-      // wait_time *= 1.25f;
-    }
+  if (!result)
+  {
+    helper_sync_stats.num_timeouts++;
+    fprintf(stderr, "Daemons did not sync within %.2fs\n", timeout_ms / 1000.f);
+    LOKI_FOR_EACH(daemon_index, num_daemons)
+      fprintf(stderr, "  daemon_%d at height %zu, top block %s\n", daemons[daemon_index].id, tips[daemon_index].height, tips[daemon_index].top_block_hash.len ? tips[daemon_index].top_block_hash.str : "<unknown>");
   }
+
+  return result;
 }
 
 void helper_cleanup_blockchain_environment(helper_blockchain_environment *environment)
@@ -180,13 +313,41 @@ void helper_cleanup_blockchain_environment(helper_blockchain_environment *enviro
     wallet_exit(&wallet);
 }
 
-bool helper_setup_blockchain(helper_blockchain_environment *environment,
-                             test_result const *context,
-                             start_daemon_params daemon_param,
-                             int num_service_nodes,
-                             int num_daemons,
-                             int num_wallets,
-                             int wallet_balance)
+bool     helper_deterministic_wallets = false;
+uint64_t helper_wallet_seed           = 0;
+
+// NOTE: The top nibble of the last byte is cleared so the little endian key is below the curve order
+// and the wallet accepts it as a scalar without reducing it.
+static loki_hash64 helper_wallet_spend_key(char const *scenario_name, int wallet_index)
+{
+  uint8_t key[32] = {};
+  for (int chunk = 0; chunk < 4; chunk++)
+  {
+    uint64_t hash = helper_fnv1a_64(&helper_wallet_seed, sizeof(helper_wallet_seed));
+    hash          = helper_fnv1a_64(scenario_name, strlen(scenario_name), hash);
+    hash          = helper_fnv1a_64(&wallet_index, sizeof(wallet_index), hash);
+    hash          = helper_fnv1a_64(&chunk, sizeof(chunk), hash);
+    LOKI_FOR_EACH(byte_index, sizeof(hash))
+      key[chunk * sizeof(hash) + byte_index] = static_cast<uint8_t>(hash >> (byte_index * 8));
+  }
+  key[31] &= 0x0f;
+
+  loki_hash64 result = {};
+  for (uint8_t byte : key)
+    result.append("%02x", byte);
+  return result;
+}
+
+// NOTE: Launch the daemons and wallets of an environment. The wallets are launched whilst the daemons
+// are still initialising. If fixture_dir is set the data dirs and wallets are restored from it,
+// otherwise everything starts from an empty chain.
+static bool helper_launch_blockchain_environment(helper_blockchain_environment *environment,
+                                                 test_result const *context,
+                                                 start_daemon_params daemon_param,
+                                                 int num_service_nodes,
+                                                 int num_daemons,
+                                                 int num_wallets,
+                                                 char const *fixture_dir)
 {
   assert(num_service_nodes + num_daemons > 0);
   assert(num_wallets > 0);
@@ -208,79 +369,416 @@ bool helper_setup_blockchain(helper_blockchain_environment *environment,
 
   daemon_t *all_daemons = environment->all_daemons.data();
   int total_daemons     = num_service_nodes + num_daemons;
+  LOKI_FOR_EACH(daemon_index, total_daemons)
   {
-    create_and_start_multi_daemons(all_daemons, total_daemons, &daemon_param, 1, context->name.str);
-    LOKI_FOR_EACH(daemon_index, num_service_nodes)
+    all_daemons[daemon_index] = create_daemon();
+    if (fixture_dir)
     {
-      if (!daemon_print_sn_key(environment->service_nodes + daemon_index, &environment->snode_keys[daemon_index]))
+      char const *const SKIP_FILES[] = {"lock.mdb"};
+      loki_fixed_string<256> src("%s/daemon_%d", fixture_dir, (int)daemon_index);
+      if (!os_file_dir_clone(src.str, daemon_data_dir(all_daemons + daemon_index).str, SKIP_FILES, LOKI_ARRAY_COUNT(SKIP_FILES)))
         return false;
     }
   }
 
   environment->wallets.resize(num_wallets);
   environment->wallets_addr.resize(num_wallets);
-  LOKI_FOR_EACH (wallet_index, num_wallets)
+  itest_ready_futures daemons_ready = start_daemon_async(all_daemons, total_daemons, &daemon_param, 1, context->name.str);
+  itest_ready_futures wallets_ready;
+  LOKI_FOR_EACH(wallet_index, num_wallets)
   {
-    wallet_t *wallet       = &environment->wallets[wallet_index];
-    loki_addr *wallet_addr = &environment->wallets_addr[wallet_index];
-
     start_wallet_params wallet_params = {};
     wallet_params.daemon              = all_daemons + 0;
-    *wallet = create_and_start_wallet(daemon_param.nettype, wallet_params, context->name.str);
-    wallet_set_default_testing_settings(wallet);
+    if (fixture_dir)                       wallet_params.wallet_file = loki_fixed_string<256>("%s/wallet_%d", fixture_dir, (int)wallet_index);
+    else if (helper_deterministic_wallets) wallet_params.spend_key   = helper_wallet_spend_key(context->name.str, (int)wallet_index);
+
+    // NOTE: Configure and address each wallet as soon as it is up instead of after the slowest one
+    wallet_t *wallet                 = &environment->wallets[wallet_index];
+    loki_addr *wallet_addr           = &environment->wallets_addr[wallet_index];
+    std::future<void> wallet_started = create_and_start_wallet_async(wallet, daemon_param.nettype, wallet_params, context->name.str);
+    itest_cancel_token *cancel_token = itest_async_current_cancel_token();
+    wallets_ready.push_back(std::async(std::launch::async, [wallet, wallet_addr, cancel_token, started = std::move(wallet_started)]() mutable
+    {
+      itest_async_set_cancel_token(cancel_token);
+      started.get();
+      wallet_set_default_testing_settings(wallet);
+      if (!wallet_address(wallet, 0, wallet_addr))
+        *wallet_addr = {};
+    }));
+  }
 
-    if (!wallet_address(wallet, 0, wallet_addr))
+  itest_wait_until_ready(&daemons_ready);
+  LOKI_FOR_EACH(daemon_index, num_service_nodes)
+  {
+    if (!daemon_print_sn_key(environment->service_nodes + daemon_index, &environment->snode_keys[daemon_index]))
       return false;
+  }
 
-    wallet_mine_until_unlocked_balance(wallet, all_daemons + 0, wallet_balance);
+  itest_wait_until_ready(&wallets_ready);
+  for (loki_addr const &addr : environment->wallets_addr)
+  {
+    if (addr.buf.len == 0)
+      return false;
   }
 
-  // Mine the initial blocks in the blockchain
+  return true;
+}
+
+// NOTE: Register service nodes in two phases. The registration commands are prepared on every daemon at
+// once, then each funding wallet submits its share in a batch, concurrently with the other wallets so
+// consecutive registrations don't contend on one wallet's outputs. Service node i is funded by wallet i,
+// the first wallet funds any service nodes beyond the number of funding wallets.
+static bool helper_register_service_nodes(daemon_t *service_nodes,
+                                          int num_service_nodes,
+                                          wallet_t *wallets,
+                                          loki_addr const *wallets_addr,
+                                          int num_wallets)
+{
+  assert(num_wallets > 0);
+  auto funding_wallet_index = [num_wallets](int daemon_index) { return (daemon_index < num_wallets) ? daemon_index : 0; };
+
+  std::vector<loki_fixed_string<>> registration_cmds(num_service_nodes);
+  std::vector<char>                prepared(num_service_nodes);
+  itest_cancel_token *cancel_token = itest_async_current_cancel_token();
   {
-    int const BLOCKS_TO_BATCH_MINE = 4;
-    for (size_t i = 0; i < MIN_BLOCKS_IN_BLOCKCHAIN / BLOCKS_TO_BATCH_MINE; i++)
+    itest_ready_futures registrations_prepared;
+    LOKI_FOR_EACH(daemon_index, num_service_nodes)
     {
-      daemon_mine_n_blocks(all_daemons + 0, &environment->wallets[0], BLOCKS_TO_BATCH_MINE);
-      LOKI_FOR_EACH(daemon_index, total_daemons)
+      int wallet_index = funding_wallet_index(daemon_index);
+      registrations_prepared.push_back(std::async(std::launch::async, [&, daemon_index, wallet_index, cancel_token]()
       {
-        daemon_t *daemon = all_daemons + daemon_index;
-        daemon_relay_votes_and_uptime(daemon);
-      }
-      helper_block_until_blockchains_are_synced(all_daemons, total_daemons);
+        itest_async_set_cancel_token(cancel_token);
+        daemon_prepare_registration_params params             = {};
+        params.contributors[params.num_contributors].addr     = wallets_addr[wallet_index];
+        params.contributors[params.num_contributors++].amount = 100;
+        prepared[daemon_index] = daemon_prepare_registration(service_nodes + daemon_index, &params, &registration_cmds[daemon_index]);
+      }));
     }
+    itest_wait_until_ready(&registrations_prepared);
+  }
+
+  for (char ok : prepared)
+  {
+    if (!ok)
+      return false;
+  }
 
-    for (size_t i = 0; i < MIN_BLOCKS_IN_BLOCKCHAIN % BLOCKS_TO_BATCH_MINE; i++)
+  std::vector<char> submitted(LOKI_MIN(num_wallets, num_service_nodes));
+  {
+    itest_ready_futures registrations_submitted;
+    LOKI_FOR_EACH(wallet_index, submitted.size())
     {
-      daemon_mine_n_blocks(all_daemons + 0, &environment->wallets[0], 1);
-      LOKI_FOR_EACH(daemon_index, total_daemons)
+      registrations_submitted.push_back(std::async(std::launch::async, [&, wallet_index, cancel_token]()
       {
-        daemon_t *daemon = all_daemons + daemon_index;
-        daemon_relay_votes_and_uptime(daemon);
-      }
-      helper_block_until_blockchains_are_synced(all_daemons, total_daemons);
+        itest_async_set_cancel_token(cancel_token);
+        bool result = true;
+        for (int daemon_index = 0; result && daemon_index < num_service_nodes; daemon_index++)
+        {
+          if (funding_wallet_index(daemon_index) == static_cast<int>(wallet_index))
+            result = wallet_register_service_node(wallets + wallet_index, registration_cmds[daemon_index].str);
+        }
+        submitted[wallet_index] = result;
+      }));
     }
+    itest_wait_until_ready(&registrations_submitted);
   }
 
-  // Register the service node
-  LOKI_FOR_EACH(daemon_index, environment->num_service_nodes)
+  for (char ok : submitted)
   {
-    daemon_prepare_registration_params params             = {};
-    params.contributors[params.num_contributors].addr     = environment->wallets_addr[0];
-    params.contributors[params.num_contributors++].amount = 100;
+    if (!ok)
+      return false;
+  }
 
-    loki_fixed_string<> registration_cmd = {};
-    if (!daemon_prepare_registration(&environment->service_nodes[daemon_index], &params, &registration_cmd) ||
-        !wallet_register_service_node(&environment->wallets[0], registration_cmd.str))
+  return true;
+}
+
+// NOTE: Fund every wallet in one mining pass. Each wallet's planned reward is mined to its address back
+// to back and a single unlock window is mined on top for all of them, instead of one window per wallet.
+static void helper_fund_wallets(helper_blockchain_environment *environment, daemon_t *miner, uint64_t desired_unlocked_balance)
+{
+  if (desired_unlocked_balance == 0)
+    return;
+
+  uint64_t height = daemon_status(miner).height;
+  LOKI_FOR_EACH(wallet_index, environment->wallets.size())
+  {
+    uint64_t blocks = loki_blocks_until_mined_reward(height, desired_unlocked_balance);
+    daemon_mine_n_blocks(miner, &environment->wallets_addr[wallet_index], static_cast<int>(blocks));
+    height += blocks;
+  }
+  daemon_mine_n_blocks(miner, &environment->wallets_addr[0], LOKI_CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW);
+
+  itest_ready_futures wallets_refreshed;
+  itest_cancel_token *cancel_token = itest_async_current_cancel_token();
+  for (wallet_t &wallet : environment->wallets)
+  {
+    wallet_t *refresh_wallet = &wallet;
+    wallets_refreshed.push_back(std::async(std::launch::async, [refresh_wallet, cancel_token]()
     {
+      itest_async_set_cancel_token(cancel_token);
+      wallet_refresh(refresh_wallet);
+    }));
+  }
+  itest_wait_until_ready(&wallets_refreshed);
+
+  // NOTE: The plan is a lower bound, this only mines more for a wallet that still came up short. The
+  // daemon is driven over one pipe so top ups stay serial.
+  for (wallet_t &wallet : environment->wallets)
+    wallet_mine_until_unlocked_balance(&wallet, miner, desired_unlocked_balance);
+}
+
+// NOTE: Mine to target_height as fast as the daemons can follow. The batch size grows while the daemons
+// converge quickly after a batch and shrinks when they lag. Votes only need relaying once a checkpoint
+// height is reached, so when relay_votes is set batches stop at checkpoint heights and the relay on
+// the other daemons runs while the miner mines the next batch.
+static bool helper_mine_until_height(daemon_t *daemons, int num_daemons, loki_addr const *miner_addr, uint64_t target_height, bool relay_votes)
+{
+  int const MAX_BLOCKS_TO_BATCH_MINE = 64;
+  int const TARGET_SYNC_MS           = 250;
+
+  daemon_t *miner      = daemons + 0;
+  uint64_t height      = daemon_status(miner).height;
+  int blocks_to_batch  = LOKI_CHECKPOINT_INTERVAL;
+  bool relay_pending   = false;
+  while (height < target_height || relay_pending)
+  {
+    int blocks = static_cast<int>(LOKI_MIN(static_cast<uint64_t>(blocks_to_batch), loki_blocks_until_height(height, target_height)));
+    if (relay_votes)
+      blocks = LOKI_MIN(blocks, static_cast<int>(LOKI_CHECKPOINT_INTERVAL - (height % LOKI_CHECKPOINT_INTERVAL)));
+
+    daemon_broadcast_acks relay = {};
+    if (relay_pending)
+      relay = daemon_broadcast_start(daemons + 1, num_daemons - 1, daemon_broadcast_cmd::relay_votes_and_uptime);
+
+    daemon_mine_n_blocks(miner, miner_addr, blocks);
+    daemon_broadcast_wait(&relay);
+
+    height       += blocks;
+    relay_pending = relay_votes && blocks > 0 && (height % LOKI_CHECKPOINT_INTERVAL) == 0;
+    if (relay_pending)
+      daemon_relay_votes_and_uptime(miner);
+
+    auto sync_start = std::chrono::steady_clock::now();
+    if (!helper_block_until_blockchains_are_synced(daemons, num_daemons))
       return false;
-    }
+
+    auto sync_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - sync_start).count();
+    if (sync_ms < TARGET_SYNC_MS / 2)  blocks_to_batch = LOKI_MIN(blocks_to_batch * 2, MAX_BLOCKS_TO_BATCH_MINE);
+    else if (sync_ms > TARGET_SYNC_MS) blocks_to_batch = LOKI_MAX(blocks_to_batch / 2, 1);
   }
 
-  daemon_mine_n_blocks(all_daemons + 0, &environment->wallets[0], 1);
-  helper_block_until_blockchains_are_synced(all_daemons, total_daemons);
   return true;
 }
 
+static bool helper_generate_blockchain(helper_blockchain_environment *environment,
+                                       test_result const *context,
+                                       start_daemon_params daemon_param,
+                                       int num_service_nodes,
+                                       int num_daemons,
+                                       int num_wallets,
+                                       int wallet_balance,
+                                       int num_blocks)
+{
+  if (!helper_launch_blockchain_environment(environment, context, daemon_param, num_service_nodes, num_daemons, num_wallets, nullptr /*fixture_dir*/))
+    return false;
+
+  daemon_t *all_daemons = environment->all_daemons.data();
+  int total_daemons     = num_service_nodes + num_daemons;
+  helper_fund_wallets(environment, all_daemons + 0, wallet_balance * LOKI_ATOMIC_UNITS);
+
+  // Mine the rest of the initial blocks in the blockchain, the funding above counts towards it. Nothing
+  // is registered yet so there are no votes to relay.
+  if (!helper_mine_until_height(all_daemons, total_daemons, &environment->wallets_addr[0], num_blocks, false /*relay_votes*/))
+    return false;
+
+  // NOTE: Wallets past the first only hold wallet_balance, they can fund a registration of their own if that
+  // covers the stake and the fee
+  int num_funding_wallets = 1;
+  if (daemon_param.nettype == loki_nettype::fakenet && static_cast<uint64_t>(wallet_balance) > LOKI_FAKENET_STAKING_REQUIREMENT)
+    num_funding_wallets = num_wallets;
+
+  if (!helper_register_service_nodes(environment->service_nodes, environment->num_service_nodes, environment->wallets.data(), environment->wallets_addr.data(), num_funding_wallets))
+    return false;
+
+  daemon_mine_n_blocks(all_daemons + 0, &environment->wallets[0], 1);
+  bool result = helper_block_until_blockchains_are_synced(all_daemons, total_daemons);
+  return result;
+}
+
+//
+// NOTE: Fixture Cache
+//
+bool helper_fixture_cache_enabled = true;
+char const HELPER_FIXTURE_CACHE_DIR[] = "./fixture_cache";
+
+// NOTE: Fixtures are only valid for the binaries that produced them, a rebuilt daemon or wallet may
+// not be able to read the data dirs or produce the same chain.
+static uint64_t helper_binaries_hash()
+{
+  LOCAL_PERSIST uint64_t const result = []() {
+    uint64_t hash = helper_fnv1a_64(nullptr, 0);
+    for (char const *path : {"./lokid", "./loki-wallet-cli"})
+    {
+      FILE *file = fopen(path, "rb");
+      if (!file) continue;
+
+      char buf[64 * 1024];
+      for (size_t bytes_read = 0; (bytes_read = fread(buf, 1, sizeof(buf), file)) > 0;)
+        hash = helper_fnv1a_64(buf, bytes_read, hash);
+      fclose(file);
+    }
+    return hash;
+  }();
+  return result;
+}
+
+// NOTE: Deterministic wallet keys are derived from the scenario name, so with them the scenario is part
+// of the key. Otherwise whichever scenario populated the cache first would decide the chain others restore.
+static std::string helper_fixture_manifest(start_daemon_params const *daemon_param, int num_service_nodes, int num_daemons, int num_wallets, int wallet_balance, int num_blocks, char const *scenario_name)
+{
+  std::string result;
+  result += loki_fixed_string<128>("hardforks=").str;
+  LOKI_FOR_EACH(i, daemon_param->num_hardforks)
+    result += loki_fixed_string<128>("%d:%d,", daemon_param->hardforks[i].version, daemon_param->hardforks[i].height).str;
+
+  result += loki_fixed_string<256>("\nnettype=%d\nfixed_difficulty=%d\nservice_node_mode=%d\n",
+                                   static_cast<int>(daemon_param->nettype),
+                                   daemon_param->fixed_difficulty,
+                                   daemon_param->service_node).str;
+  result += "custom_cmd_line=";
+  result += daemon_param->custom_cmd_line.str;
+  result += loki_fixed_string<256>("\nservice_nodes=%d\ndaemons=%d\nwallets=%d\nwallet_balance_atomic=%llu\nmin_blocks=%d\nbinaries=%016llx\n",
+                                   num_service_nodes,
+                                   num_daemons,
+                                   num_wallets,
+                                   static_cast<unsigned long long>(wallet_balance * LOKI_ATOMIC_UNITS),
+                                   num_blocks,
+                                   static_cast<unsigned long long>(helper_binaries_hash())).str;
+  if (helper_deterministic_wallets)
+  {
+    result += loki_fixed_string<64>("wallet_seed=%llu\n", static_cast<unsigned long long>(helper_wallet_seed)).str;
+    result += loki_fixed_string<600>("scenario=%s\n", scenario_name).str;
+  }
+  return result;
+}
+
+// NOTE: Stops the environment so the data dirs and wallets are flushed to disk, then copies them into
+// the cache. The fixture is staged under a temporary name and renamed into place so that a scenario
+// never sees a partially written fixture, if another scenario stored the same fixture first we keep theirs.
+static bool helper_fixture_store(helper_blockchain_environment *environment, char const *fixture_dir, std::string const &manifest)
+{
+  int const EXIT_TIMEOUT_MS = 30 * 1000;
+  bool result               = true;
+  for (daemon_t &daemon : environment->all_daemons)
+  {
+    daemon_exit(&daemon);
+    if (!os_wait_for_process_exit(daemon.pid, EXIT_TIMEOUT_MS))
+    {
+      itest_kill_process(daemon.pid);
+      result = false;
+    }
+  }
+
+  for (wallet_t &wallet : environment->wallets)
+  {
+    wallet_exit(&wallet);
+    if (!os_wait_for_process_exit(wallet.pid, EXIT_TIMEOUT_MS))
+    {
+      itest_kill_process(wallet.pid);
+      result = false;
+    }
+  }
+
+  if (!result)
+    return result;
+
+  if (!os_file_exists(HELPER_FIXTURE_CACHE_DIR))
+    os_file_dir_make(HELPER_FIXTURE_CACHE_DIR);
+
+  loki_fixed_string<256> staging_dir("%s.staging_%d", fixture_dir, environment->all_daemons[0].pid); // NOTE: Unique across shards on the same host
+  if (os_file_exists(staging_dir.str)) os_file_dir_delete(staging_dir.str);
+  result = os_file_dir_make(staging_dir.str);
+
+  LOKI_FOR_EACH(daemon_index, environment->all_daemons.size())
+  {
+    if (!result) break;
+    char const *const SKIP_FILES[] = {"lock.mdb"};
+    loki_fixed_string<256> dest("%s/daemon_%d", staging_dir.str, (int)daemon_index);
+    result = os_file_dir_clone(daemon_data_dir(&environment->all_daemons[daemon_index]).str, dest.str, SKIP_FILES, LOKI_ARRAY_COUNT(SKIP_FILES));
+  }
+
+  LOKI_FOR_EACH(wallet_index, environment->wallets.size())
+  {
+    if (!result) break;
+    loki_fixed_string<256> wallet_path = wallet_file_path(&environment->wallets[wallet_index]);
+    result = os_file_clone(wallet_path.str,                                          loki_fixed_string<256>("%s/wallet_%d", staging_dir.str, (int)wallet_index).str) &&
+             os_file_clone(loki_fixed_string<256>("%s.keys", wallet_path.str).str, loki_fixed_string<256>("%s/wallet_%d.keys", staging_dir.str, (int)wallet_index).str);
+  }
+
+  if (result)
+  {
+    loki_fixed_string<256> manifest_path("%s/manifest", staging_dir.str);
+    result = os_write_file(manifest_path.str, manifest.c_str(), static_cast<int>(manifest.size()));
+  }
+
+  if (result && rename(staging_dir.str, fixture_dir) != 0)
+    result = os_file_exists(fixture_dir);
+
+  if (os_file_exists(staging_dir.str))
+    os_file_dir_delete(staging_dir.str);
+  return result;
+}
+
+bool helper_setup_blockchain(helper_blockchain_environment *environment,
+                             test_result const *context,
+                             start_daemon_params daemon_param,
+                             int num_service_nodes,
+                             int num_daemons,
+                             int num_wallets,
+                             int wallet_balance,
+                             int num_blocks)
+{
+  // NOTE: Terminals kept open outlive their process so we can't tell when the fixture is flushed to disk
+  if (!helper_fixture_cache_enabled || daemon_param.keep_terminal_open)
+    return helper_generate_blockchain(environment, context, daemon_param, num_service_nodes, num_daemons, num_wallets, wallet_balance, num_blocks);
+
+  std::string manifest = helper_fixture_manifest(&daemon_param, num_service_nodes, num_daemons, num_wallets, wallet_balance, num_blocks, context->name.str);
+  loki_fixed_string<256> fixture_dir("%s/%016llx", HELPER_FIXTURE_CACHE_DIR, static_cast<unsigned long long>(helper_fnv1a_64(manifest.data(), manifest.size())));
+
+  if (!os_file_exists(fixture_dir.str))
+  {
+    helper_blockchain_environment generated = {};
+    bool stored = helper_generate_blockchain(&generated, context, daemon_param, num_service_nodes, num_daemons, num_wallets, wallet_balance, num_blocks) &&
+                  helper_fixture_store(&generated, fixture_dir.str, manifest);
+    if (!stored)
+    {
+      for (daemon_t &daemon : generated.all_daemons) { itest_kill_process(daemon.pid); itest_ipc_clean_up(&daemon.ipc); }
+      for (wallet_t &wallet : generated.wallets)     { itest_kill_process(wallet.pid); itest_ipc_clean_up(&wallet.ipc); }
+      return helper_generate_blockchain(environment, context, daemon_param, num_service_nodes, num_daemons, num_wallets, wallet_balance, num_blocks);
+    }
+  }
+
+  bool result = helper_launch_blockchain_environment(environment, context, daemon_param, num_service_nodes, num_daemons, num_wallets, fixture_dir.str);
+  if (result)
+  {
+    daemon_t *all_daemons = environment->all_daemons.data();
+    result                = helper_block_until_blockchains_are_synced(all_daemons, num_service_nodes + num_daemons);
+  }
+  return result;
+}
+
+//
+// NOTE: Shared Fixtures
+//
+static bool latest_funded_wallet_setup(helper_blockchain_environment *environment, test_result const *context)
+{
+  start_daemon_params daemon_params = {};
+  daemon_params.load_latest_hardfork_versions();
+  bool result = helper_setup_blockchain(environment, context, daemon_params, 0 /*service nodes*/, 1 /*daemons*/, 1 /*wallets*/, 100 /*wallet balance*/);
+  return result;
+}
+itest_fixture_info const latest_funded_wallet = {latest_funded_wallet_setup, "latest_funded_wallet", 1 /*daemons*/, 1 /*wallets*/};
+
 bool helper_setup_blockchain_with_n_service_nodes(test_result const *context,
                                                   daemon_t *daemons,
                                                   loki_snode_key *snode_keys,
@@ -308,22 +806,11 @@ bool helper_setup_blockchain_with_n_service_nodes(test_result const *context,
     return false;
 
   daemon_mine_n_blocks(daemons + 0, wallet, MIN_BLOCKS_IN_BLOCKCHAIN);
-  helper_block_until_blockchains_are_synced(daemons, num_daemons);
-
-  // Register the service node
-  LOKI_FOR_EACH(daemon_index, num_daemons)
-  {
-    daemon_prepare_registration_params params             = {};
-    params.contributors[params.num_contributors].addr     = *addr;
-    params.contributors[params.num_contributors++].amount = 100;
+  if (!helper_block_until_blockchains_are_synced(daemons, num_daemons))
+    return false;
 
-    loki_fixed_string<> registration_cmd = {};
-    if (!daemon_prepare_registration(daemons + daemon_index, &params, &registration_cmd) ||
-        !wallet_register_service_node(wallet, registration_cmd.str))
-    {
-      return false;
-    }
-  }
+  if (!helper_register_service_nodes(daemons, num_daemons, wallet, addr, 1 /*num_wallets*/))
+    return false;
 
   return true;
 }
@@ -361,7 +848,7 @@ test_result foo()
   for (;;)
   {
     daemon_status(&daemon);
-    os_sleep_ms(2000);
+    itest_sleep_ms(2000);
   }
 #else
   const int NUM_DAEMONS = 20;
@@ -379,11 +866,7 @@ test_result foo()
   for (;;)
   {
     daemon_mine_n_blocks(daemons + 0, &addr, 1);
-    LOKI_FOR_EACH(daemon_index, NUM_DAEMONS)
-    {
-      daemon_t *daemon = daemons + daemon_index;
-      daemon_relay_votes_and_uptime(daemon);
-    }
+    daemon_broadcast(daemons, NUM_DAEMONS, daemon_broadcast_cmd::relay_votes_and_uptime);
     helper_block_until_blockchains_are_synced(daemons, NUM_DAEMONS);
   }
 #endif
@@ -392,6 +875,7 @@ test_result foo()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__checkpointing__private_chain_reorgs_to_checkpoint_chain, "checkpointing", ITEST_HF_LATEST, 6 /*daemons*/, 2 /*wallets*/);
 test_result latest__checkpointing__private_chain_reorgs_to_checkpoint_chain()
 {
   test_result result = {};
@@ -426,13 +910,9 @@ test_result latest__checkpointing__private_chain_reorgs_to_checkpoint_chain()
   {
     daemon_mine_n_blocks(service_nodes + 0, wallet, LOKI_CHECKPOINT_INTERVAL);
     helper_block_until_blockchains_are_synced(service_nodes, NUM_DAEMONS - 1);
-    LOKI_FOR_EACH(daemon_index, NUM_SERVICE_NODES)
-    {
-      daemon_t *daemon = service_nodes + daemon_index;
-      daemon_relay_votes_and_uptime(daemon);
-    }
+    daemon_broadcast(service_nodes, NUM_SERVICE_NODES, daemon_broadcast_cmd::relay_votes_and_uptime);
     daemon_status(naughty_daemon);
-    os_sleep_ms(1000);
+    itest_sleep_ms(1000);
   }
 
   // Naughty daemon mines their chain secretly ahead of the canonical chain
@@ -472,7 +952,7 @@ test_result latest__checkpointing__private_chain_reorgs_to_checkpoint_chain()
 
   for (int i = 0; naughty_height != target_blockchain_height; i++)
   {
-    os_sleep_ms(1500);
+    itest_sleep_ms(1500);
     naughty_daemon_status = daemon_status(naughty_daemon);
     naughty_height        = naughty_daemon_status.height;
   }
@@ -500,6 +980,7 @@ test_result latest__checkpointing__private_chain_reorgs_to_checkpoint_chain()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__checkpointing__new_peer_syncs_checkpoints, "checkpointing", ITEST_HF_LATEST, 11 /*daemons*/, 1 /*wallets*/);
 test_result latest__checkpointing__new_peer_syncs_checkpoints()
 {
   test_result result = {};
@@ -514,15 +995,45 @@ test_result latest__checkpointing__new_peer_syncs_checkpoints()
   loki_snode_key snode_keys[NUM_DAEMONS] = {};
   daemon_t daemons[NUM_DAEMONS]          = {};
 
-  create_and_start_multi_daemons(daemons, NUM_DAEMONS, &daemon_params, 1, result.name.str);
+  // NOTE: Mine the initial blockchain once on a template daemon and start the service nodes from a clone
+  // of its data dir, instead of every service node syncing it over P2P. The new peer starts from an empty
+  // chain since syncing is what's being tested.
+  start_daemon_params service_node_params = daemon_params;
+  loki_fixed_string<256> template_wallet_file;
+  {
+    daemon_t template_daemon = {};
+    create_and_start_multi_daemons(&template_daemon, 1, &daemon_params, 1, result.name.str);
+
+    start_wallet_params wallet_params = {};
+    wallet_params.daemon              = &template_daemon;
+    wallet_t template_wallet          = create_and_start_wallet(daemon_params.nettype, wallet_params, result.name.str);
+    daemon_mine_n_blocks(&template_daemon, &template_wallet, MIN_BLOCKS_IN_BLOCKCHAIN);
+    wallet_refresh(&template_wallet);
+
+    // NOTE: Both write their files out on exit, they have to be stopped before they're copied
+    int const EXIT_TIMEOUT_MS = 30 * 1000;
+    wallet_exit(&template_wallet);
+    daemon_exit(&template_daemon);
+    EXPECT(result, os_wait_for_process_exit(template_wallet.pid, EXIT_TIMEOUT_MS), "Template wallet did not exit");
+    EXPECT(result, os_wait_for_process_exit(template_daemon.pid, EXIT_TIMEOUT_MS), "Template daemon did not exit");
+
+    service_node_params.template_data_dir = daemon_data_dir(&template_daemon);
+    template_wallet_file                  = wallet_file_path(&template_wallet);
+  }
+
+  start_daemon_params all_daemon_params[NUM_DAEMONS] = {};
+  LOKI_FOR_EACH(daemon_index, NUM_DAEMONS)
+    all_daemon_params[daemon_index] = (daemon_index < NUM_SERVICE_NODES) ? service_node_params : daemon_params;
+
+  create_and_start_multi_daemons(daemons, NUM_DAEMONS, all_daemon_params, NUM_DAEMONS, result.name.str);
   for (size_t i = 0; i < NUM_SERVICE_NODES; ++i)
     LOKI_ASSERT(daemon_print_sn_key(daemons + i, snode_keys + i));
 
-  LOKI_FOR_ITERATOR(daemon, daemons, NUM_DAEMONS)
-    daemon_toggle_obligation_quorum(daemon);
+  daemon_broadcast(daemons, NUM_DAEMONS, daemon_broadcast_cmd::toggle_obligation_quorum);
 
   start_wallet_params wallet_params = {};
   wallet_params.daemon              = daemons + 0;
+  wallet_params.wallet_file         = template_wallet_file;
   wallet_t wallet                   = create_and_start_wallet(daemon_params.nettype, wallet_params, result.name.str);
   wallet_set_default_testing_settings(&wallet);
 
@@ -537,7 +1048,7 @@ test_result latest__checkpointing__new_peer_syncs_checkpoints()
   };
 
   // Setup node registration params to come from our single wallet
-  daemon_mine_n_blocks(daemons + 0, &wallet, MIN_BLOCKS_IN_BLOCKCHAIN);
+  wallet_refresh(&wallet);
   {
     daemon_prepare_registration_params register_params                    = {};
     register_params.contributors[register_params.num_contributors].amount = LOKI_FAKENET_STAKING_REQUIREMENT;
@@ -557,9 +1068,8 @@ test_result latest__checkpointing__new_peer_syncs_checkpoints()
   {
     daemon_mine_n_blocks(daemons + 0, &wallet, LOKI_CHECKPOINT_INTERVAL);
     helper_block_until_blockchains_are_synced(daemons, NUM_SERVICE_NODES);
-    LOKI_FOR_ITERATOR(daemon, daemons, NUM_SERVICE_NODES)
-      daemon_relay_votes_and_uptime(daemon);
-    os_sleep_ms(1000);
+    daemon_broadcast(daemons, NUM_SERVICE_NODES, daemon_broadcast_cmd::relay_votes_and_uptime);
+    itest_sleep_ms(1000);
   }
 
   // Unban localhost, restoring connection to the new peer and see if it syncs up
@@ -572,7 +1082,7 @@ test_result latest__checkpointing__new_peer_syncs_checkpoints()
   // NOTE: Retry a couple of times and wait for the new peer to sync
   for (int i = 0; i < 100 && new_peer_height != target_blockchain_height; i++)
   {
-    os_sleep_ms(2000);
+    itest_sleep_ms(2000);
     new_peer_status = daemon_status(new_peer);
     new_peer_height = new_peer_status.height;
   }
@@ -594,6 +1104,7 @@ test_result latest__checkpointing__new_peer_syncs_checkpoints()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__checkpointing__deregister_non_participating_peer, "checkpointing deregistration", ITEST_HF_LATEST, 10 /*daemons*/, 1 /*wallets*/);
 test_result latest__checkpointing__deregister_non_participating_peer()
 {
   // NOTE: Setup environment
@@ -621,7 +1132,7 @@ test_result latest__checkpointing__deregister_non_participating_peer()
   // NOTE: Test Start
   int const NUM_GOOD_SERVICE_NODES     = NUM_SERVICE_NODES - NUM_BAD_SERVICE_NODES;
   LOKI_ASSERT(NUM_BAD_SERVICE_NODES > 0);
-  wallet_t *wallet                      = environment.wallets.data();
+  loki_addr const *miner_addr           = environment.wallets_addr.data();
   daemon_t *good_service_nodes          = environment.service_nodes;
   daemon_t *bad_service_nodes           = environment.service_nodes + NUM_GOOD_SERVICE_NODES;
   loki_snode_key *bad_service_node_keys = environment.snode_keys.data() + NUM_GOOD_SERVICE_NODES;
@@ -634,22 +1145,21 @@ test_result latest__checkpointing__deregister_non_participating_peer()
     daemon_status(node);
   }
 
-  for (daemon_t &daemon : environment.all_daemons)
-  {
-    daemon_toggle_obligation_uptime_proof(&daemon);
-    daemon_relay_votes_and_uptime(&daemon);
-  }
+  daemon_t *all_daemons = environment.all_daemons.data();
+  int total_daemons     = static_cast<int>(environment.all_daemons.size());
+  daemon_broadcast(all_daemons, total_daemons, daemon_broadcast_cmd::toggle_obligation_uptime_proof);
+  daemon_broadcast(all_daemons, total_daemons, daemon_broadcast_cmd::relay_votes_and_uptime);
 
   int blocks_to_try = 1200;
-  daemon_t *miner = good_service_nodes + 0;
+  uint64_t height   = daemon_status(good_service_nodes + 0).height;
   LOKI_FOR_EACH(i, (blocks_to_try / LOKI_CHECKPOINT_INTERVAL))
   {
-    daemon_mine_n_blocks(miner, wallet, LOKI_CHECKPOINT_INTERVAL);
-    helper_block_until_blockchains_are_synced(good_service_nodes, NUM_GOOD_SERVICE_NODES);
-
-    LOKI_FOR_ITERATOR(node, good_service_nodes, NUM_GOOD_SERVICE_NODES)
-      daemon_relay_votes_and_uptime(node);
-    os_sleep_ms(250);
+    // NOTE: Mine to the next checkpoint height, the good nodes relay their votes once it's reached
+    height = ((height / LOKI_CHECKPOINT_INTERVAL) + 1) * LOKI_CHECKPOINT_INTERVAL;
+    EXPECT(result,
+           helper_mine_until_height(good_service_nodes, NUM_GOOD_SERVICE_NODES, miner_addr, height, true /*relay_votes*/),
+           "The good service nodes did not sync to height %zu", height);
+    itest_sleep_ms(250);
 
     LOKI_FOR_ITERATOR(bad_key, bad_service_node_keys, NUM_BAD_SERVICE_NODES)
     {
@@ -666,6 +1176,8 @@ test_result latest__checkpointing__deregister_non_participating_peer()
   return result;
 }
 
+// NOTE(doyle): Doesn't work
+LOKI_REGISTER_DISABLED_SCENARIO(latest__decommission__recommission_on_uptime_proof, "decommission", ITEST_HF_LATEST, 6 /*daemons*/, 1 /*wallets*/);
 test_result latest__decommission__recommission_on_uptime_proof()
 {
   test_result result = {};
@@ -707,10 +1219,9 @@ test_result latest__decommission__recommission_on_uptime_proof()
        status = daemon_print_sn(miner, bad_snode_key))
   {
     daemon_mine_n_blocks(miner, wallet, 1);
-    LOKI_FOR_ITERATOR(daemon, good_service_nodes, num_good_service_nodes)
-      daemon_relay_votes_and_uptime(daemon);
+    daemon_broadcast(good_service_nodes, num_good_service_nodes, daemon_broadcast_cmd::relay_votes_and_uptime);
     helper_block_until_blockchains_are_synced(good_service_nodes, num_good_service_nodes);
-    os_sleep_ms(1000);
+    itest_sleep_ms(1000);
   }
 
   EXPECT(result,
@@ -724,11 +1235,10 @@ test_result latest__decommission__recommission_on_uptime_proof()
   // NOTE: Relay uptime proof and try a couple of times to see if our uptime proof got received by the service node
   for (int tries = 0; tries < 100; ++tries)
   {
-    for (daemon_t &daemon : environment.all_daemons)
-      daemon_relay_votes_and_uptime(&daemon);
+    daemon_broadcast(environment.all_daemons.data(), static_cast<int>(environment.all_daemons.size()), daemon_broadcast_cmd::relay_votes_and_uptime);
     status = daemon_print_sn(good_service_nodes + 0, bad_snode_key);
     if (status.last_uptime_proof_received) break;
-    os_sleep_ms(1000);
+    itest_sleep_ms(1000);
   }
 
   EXPECT(result,
@@ -742,14 +1252,14 @@ test_result latest__decommission__recommission_on_uptime_proof()
   {
     daemon_mine_n_blocks(good_service_nodes + 0, wallet, 1);
     helper_block_until_blockchains_are_synced(environment.service_nodes, environment.num_service_nodes);
-    for (daemon_t &daemon : environment.all_daemons)
-      daemon_relay_votes_and_uptime(&daemon);
-    os_sleep_ms(2000);
+    daemon_broadcast(environment.all_daemons.data(), static_cast<int>(environment.all_daemons.size()), daemon_broadcast_cmd::relay_votes_and_uptime);
+    itest_sleep_ms(2000);
   }
 
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__deregistration__n_unresponsive_node, "deregistration", ITEST_HF_LATEST, 10 /*daemons*/, 1 /*wallets*/);
 test_result latest__deregistration__n_unresponsive_node()
 {
   test_result result = {};
@@ -791,8 +1301,8 @@ test_result latest__deregistration__n_unresponsive_node()
   // Prepare blockchain, atleast 100 blocks so we have outputs to pick from
   int const FAKECHAIN_STAKING_REQUIREMENT = 100;
   {
-    daemon_mine_n_blocks(daemons + 0, &wallet, MIN_BLOCKS_IN_BLOCKCHAIN);
-    wallet_mine_until_unlocked_balance(&wallet, daemons + 0, static_cast<int>(NUM_DAEMONS * FAKECHAIN_STAKING_REQUIREMENT)); // TODO(doyle): Assuming staking requirement of 100 fakechain
+    wallet_mine_until_unlocked_balance(&wallet, daemons + 0, NUM_DAEMONS * FAKECHAIN_STAKING_REQUIREMENT * LOKI_ATOMIC_UNITS); // TODO(doyle): Assuming staking requirement of 100 fakechain
+    daemon_mine_n_blocks(daemons + 0, &wallet, static_cast<int>(loki_blocks_until_height(daemon_status(daemons + 0).height, MIN_BLOCKS_IN_BLOCKCHAIN)));
   }
 
   // Setup node registration params to come from our single wallet
@@ -834,13 +1344,7 @@ test_result latest__deregistration__n_unresponsive_node()
     helper_block_until_blockchains_are_synced(daemons, num_register_daemons);
 
     LOKI_FOR_EACH(j, 2)
-    {
-      LOKI_FOR_EACH(i, num_register_daemons)
-      {
-        daemon_t *daemon = daemons + i;
-        daemon_relay_votes_and_uptime(daemon);
-      }
-    }
+      daemon_broadcast(daemons, num_register_daemons, daemon_broadcast_cmd::relay_votes_and_uptime);
 
     LOKI_FOR_EACH(i, NUM_DAEMONS)
     {
@@ -854,22 +1358,14 @@ test_result latest__deregistration__n_unresponsive_node()
   {
     daemon_mine_n_blocks(daemons + 0, &wallet, LOKI_REORG_SAFETY_BUFFER);
     helper_block_until_blockchains_are_synced(daemons, num_register_daemons);
-    LOKI_FOR_EACH(i, num_register_daemons)
-    {
-      daemon_t *daemon = daemons + i;
-      daemon_relay_votes_and_uptime(daemon);
-    }
+    daemon_broadcast(daemons, num_register_daemons, daemon_broadcast_cmd::relay_votes_and_uptime);
 
     // Mine blocks to deregister daemons
     int block_batch = 1;
     LOKI_FOR_EACH(i, 90 / block_batch)
     {
       daemon_mine_n_blocks(daemons + 0, &wallet, block_batch);
-      LOKI_FOR_EACH(j, num_register_daemons)
-      {
-        daemon_t *daemon = daemons + j;
-        daemon_relay_votes_and_uptime(daemon);
-      }
+      daemon_broadcast(daemons, num_register_daemons, daemon_broadcast_cmd::relay_votes_and_uptime);
       helper_block_until_blockchains_are_synced(daemons, num_register_daemons);
     }
   }
@@ -900,26 +1396,13 @@ test_result latest__deregistration__n_unresponsive_node()
   return result;
 }
 
-test_result latest__prepare_registration__check_all_solo_stake_forms_valid_registration()
+LOKI_REGISTER_FIXTURE_SCENARIO(latest__prepare_registration__check_all_solo_stake_forms_valid_registration, "registration", ITEST_HF_LATEST, latest_funded_wallet, read_only);
+test_result latest__prepare_registration__check_all_solo_stake_forms_valid_registration(helper_blockchain_environment *environment)
 {
   test_result result = {};
   INITIALISE_TEST_CONTEXT(result);
 
-  start_daemon_params daemon_params = {};
-  daemon_params.load_latest_hardfork_versions();
-
-  daemon_t daemon = create_and_start_daemon(daemon_params, result.name.str);
-  LOKI_DEFER { daemon_exit(&daemon); };
-
-  // NOTE(loki): Mine enough to reach the latest fork
-  {
-    start_wallet_params wallet_params = {};
-    wallet_params.daemon              = &daemon;
-    wallet_t wallet                   = create_and_start_wallet(daemon_params.nettype, wallet_params, result.name.str);
-    wallet_set_default_testing_settings(&wallet);
-    daemon_mine_n_blocks(&daemon, &wallet, 32);
-    wallet_exit(&wallet);
-  }
+  daemon_t *daemon = environment->daemons + 0;
 
   char const *wallet1 = LOKI_MAINNET_ADDR[0];
 
@@ -931,7 +1414,7 @@ test_result latest__prepare_registration__check_all_solo_stake_forms_valid_regis
   {
     registration_params.contributors[0].amount = i;
     loki_fixed_string<> registration_cmd = {};
-    EXPECT(result, daemon_prepare_registration(&daemon, &registration_params, &registration_cmd), "Failed to prepare registration");
+    EXPECT(result, daemon_prepare_registration(daemon, &registration_params, &registration_cmd), "Failed to prepare registration");
 
     // Expected Format: register_service_node <operator cut> <address> <fraction> [<address> <fraction> [...]]]
     char const *register_str      = str_find(registration_cmd.str, "register_service_node");
@@ -949,27 +1432,13 @@ test_result latest__prepare_registration__check_all_solo_stake_forms_valid_regis
   return result;
 }
 
-test_result latest__prepare_registration__check_solo_stake()
+LOKI_REGISTER_FIXTURE_SCENARIO(latest__prepare_registration__check_solo_stake, "registration", ITEST_HF_LATEST, latest_funded_wallet, read_only);
+test_result latest__prepare_registration__check_solo_stake(helper_blockchain_environment *environment)
 {
   test_result result = {};
   INITIALISE_TEST_CONTEXT(result);
 
-  start_daemon_params daemon_params = {};
-  daemon_params.load_latest_hardfork_versions();
-  daemon_params.keep_terminal_open = false;
-
-  daemon_t daemon = create_and_start_daemon(daemon_params, result.name.str);
-  LOKI_DEFER { daemon_exit(&daemon); };
-
-  // NOTE(loki): Mine enough to reach the latest fork
-  {
-    start_wallet_params wallet_params = {};
-    wallet_params.daemon              = &daemon;
-    wallet_t wallet                   = create_and_start_wallet(daemon_params.nettype, wallet_params, result.name.str);
-    wallet_set_default_testing_settings(&wallet);
-    daemon_mine_n_blocks(&daemon, &wallet, 32);
-    wallet_exit(&wallet);
-  }
+  daemon_t *daemon = environment->daemons + 0;
 
   char const *wallet1 = LOKI_MAINNET_ADDR[0];
 
@@ -979,7 +1448,7 @@ test_result latest__prepare_registration__check_solo_stake()
   registration_params.contributors[0].amount = 100; // TODO(doyle): Assumes staking requirement
 
   loki_fixed_string<> registration_cmd = {};
-  EXPECT(result, daemon_prepare_registration(&daemon, &registration_params, &registration_cmd), "Failed to prepare registration");
+  EXPECT(result, daemon_prepare_registration(daemon, &registration_params, &registration_cmd), "Failed to prepare registration");
 
   // Expected Format: register_service_node <operator cut> <address> <fraction> [<address> <fraction> [...]]]
   char const *register_str      = str_find(registration_cmd.str, "register_service_node");
@@ -996,26 +1465,13 @@ test_result latest__prepare_registration__check_solo_stake()
   return result;
 }
 
-test_result latest__prepare_registration__check_100_percent_operator_cut_stake()
+LOKI_REGISTER_FIXTURE_SCENARIO(latest__prepare_registration__check_100_percent_operator_cut_stake, "registration", ITEST_HF_LATEST, latest_funded_wallet, read_only);
+test_result latest__prepare_registration__check_100_percent_operator_cut_stake(helper_blockchain_environment *environment)
 {
   test_result result = {};
   INITIALISE_TEST_CONTEXT(result);
 
-  start_daemon_params daemon_params = {};
-  daemon_params.load_latest_hardfork_versions();
-
-  daemon_t daemon = create_and_start_daemon(daemon_params, result.name.str);
-  LOKI_DEFER { daemon_exit(&daemon); };
-
-  // NOTE(loki): Mine enough to reach the latest fork
-  {
-    start_wallet_params wallet_params = {};
-    wallet_params.daemon              = &daemon;
-    wallet_t wallet                   = create_and_start_wallet(daemon_params.nettype, wallet_params, result.name.str);
-    wallet_set_default_testing_settings(&wallet);
-    daemon_mine_n_blocks(&daemon, &wallet, 32);
-    wallet_exit(&wallet);
-  }
+  daemon_t *daemon = environment->daemons + 0;
 
   char const *wallet1 = LOKI_MAINNET_ADDR[0];
   char const *wallet2 = LOKI_MAINNET_ADDR[1];
@@ -1030,7 +1486,7 @@ test_result latest__prepare_registration__check_100_percent_operator_cut_stake()
   registration_params.contributors[1].amount = 25; // TODO(doyle): Assumes testnet staking requirement of 100
 
   loki_fixed_string<> registration_cmd = {};
-  EXPECT(result, daemon_prepare_registration(&daemon, &registration_params, &registration_cmd), "Failed to prepare registration");
+  EXPECT(result, daemon_prepare_registration(daemon, &registration_params, &registration_cmd), "Failed to prepare registration");
 
   // Expected Format: register_service_node [auto] <operator cut> <address> <fraction> [<address> <fraction> [...]]]
   char const *register_str     = str_find(registration_cmd.str, "register_service_node");
@@ -1052,33 +1508,20 @@ test_result latest__prepare_registration__check_100_percent_operator_cut_stake()
   return result;
 }
 
-test_result latest__print_locked_stakes__check_no_locked_stakes()
+LOKI_REGISTER_FIXTURE_SCENARIO(latest__print_locked_stakes__check_no_locked_stakes, "staking", ITEST_HF_LATEST, latest_funded_wallet, read_only);
+test_result latest__print_locked_stakes__check_no_locked_stakes(helper_blockchain_environment *environment)
 {
   test_result result = {};
   INITIALISE_TEST_CONTEXT(result);
 
-  daemon_t daemon = {};
-  wallet_t wallet = {};
-  LOKI_DEFER { wallet_exit(&wallet); daemon_exit(&daemon); };
-
-  // Start up daemon and wallet
-  {
-    start_daemon_params daemon_params = {};
-    daemon_params.load_latest_hardfork_versions();
-    daemon                            = create_and_start_daemon(daemon_params, result.name.str);
-
-    start_wallet_params wallet_params = {};
-    wallet_params.daemon              = &daemon;
-    wallet                            = create_and_start_wallet(daemon_params.nettype, wallet_params, result.name.str);
-    wallet_set_default_testing_settings(&wallet);
-  }
-
-  wallet_locked_stakes stakes = wallet_print_locked_stakes(&wallet);
+  wallet_t *wallet            = &environment->wallets[0];
+  wallet_locked_stakes stakes = wallet_print_locked_stakes(wallet);
   EXPECT(result, stakes.locked_stakes_len == 0, "We haven't staked, so there should be no locked stakes");
   EXPECT(result, stakes.blacklisted_stakes_len == 0, "We haven't staked, so there should be no locked stakes");
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__print_locked_stakes__check_shows_locked_stakes, "staking", ITEST_HF_LATEST, 1 /*daemons*/, 1 /*wallets*/);
 test_result latest__print_locked_stakes__check_shows_locked_stakes()
 {
   test_result result = {};
@@ -1148,6 +1591,7 @@ test_result latest__print_locked_stakes__check_shows_locked_stakes()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__register_service_node__allow_4_stakers, "registration staking", ITEST_HF_LATEST, 1 /*daemons*/, 4 /*wallets*/);
 test_result latest__register_service_node__allow_4_stakers()
 {
   test_result result = {};
@@ -1216,6 +1660,7 @@ test_result latest__register_service_node__allow_4_stakers()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__register_service_node__allow_70_20_and_10_open_for_contribution, "registration staking", ITEST_HF_LATEST, 1 /*daemons*/, 2 /*wallets*/);
 test_result latest__register_service_node__allow_70_20_and_10_open_for_contribution()
 {
   test_result result = {};
@@ -1285,6 +1730,7 @@ test_result latest__register_service_node__allow_70_20_and_10_open_for_contribut
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__register_service_node__allow_43_23_13_21_reserved_contribution, "registration staking", ITEST_HF_LATEST, 1 /*daemons*/, 5 /*wallets*/);
 test_result latest__register_service_node__allow_43_23_13_21_reserved_contribution()
 {
   test_result result = {};
@@ -1404,6 +1850,7 @@ test_result latest__register_service_node__allow_43_23_13_21_reserved_contributi
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__register_service_node__allow_87_13_reserved_contribution, "registration staking", ITEST_HF_LATEST, 1 /*daemons*/, 3 /*wallets*/);
 test_result latest__register_service_node__allow_87_13_reserved_contribution()
 {
   test_result result = {};
@@ -1498,6 +1945,7 @@ test_result latest__register_service_node__allow_87_13_reserved_contribution()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__register_service_node__allow_87_13_contribution, "registration staking", ITEST_HF_LATEST, 1 /*daemons*/, 3 /*wallets*/);
 test_result latest__register_service_node__allow_87_13_contribution()
 {
   test_result result = {};
@@ -1589,6 +2037,7 @@ test_result latest__register_service_node__allow_87_13_contribution()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__register_service_node__disallow_register_twice, "registration", ITEST_HF_LATEST, 1 /*daemons*/, 1 /*wallets*/);
 test_result latest__register_service_node__disallow_register_twice()
 {
   test_result result = {};
@@ -1635,6 +2084,7 @@ test_result latest__register_service_node__disallow_register_twice()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__register_service_node__check_unlock_time_is_0, "registration", ITEST_HF_LATEST, 1 /*daemons*/, 1 /*wallets*/);
 test_result latest__register_service_node__check_unlock_time_is_0()
 {
   test_result result = {};
@@ -1679,6 +2129,7 @@ test_result latest__register_service_node__check_unlock_time_is_0()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__request_stake_unlock__check_pooled_stake_unlocked, "staking unlock", ITEST_HF_LATEST, 1 /*daemons*/, 5 /*wallets*/);
 test_result latest__request_stake_unlock__check_pooled_stake_unlocked()
 {
   test_result result = {};
@@ -1812,6 +2263,7 @@ test_result latest__request_stake_unlock__check_pooled_stake_unlocked()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__request_stake_unlock__check_unlock_height, "staking unlock", ITEST_HF_LATEST, 1 /*daemons*/, 2 /*wallets*/);
 test_result latest__request_stake_unlock__check_unlock_height()
 {
   test_result result = {};
@@ -1867,33 +2319,67 @@ test_result latest__request_stake_unlock__check_unlock_height()
   return result;
 }
 
-test_result latest__request_stake_unlock__disallow_request_on_non_existent_node()
+// NOTE: The steps of the scenario below, which exits the processes however these end
+static itest_task<test_result> disallow_request_on_non_existent_node_steps(daemon_t *daemon, wallet_t *wallet, char const *name)
 {
   test_result result = {};
-  INITIALISE_TEST_CONTEXT(result);
+  result.name        = loki_fixed_string<512>("%s", name);
 
-  loki_snode_key snode_key = {};
-  daemon_t daemon          = {};
-  wallet_t wallet          = {};
-  LOKI_DEFER { daemon_exit(&daemon); wallet_exit(&wallet); };
-
-  // Setup wallet and daemon
+  // Setup wallet and daemon, the wallet starts alongside the daemon and connects once it's up
   {
     start_daemon_params daemon_params = {};
     daemon_params.load_latest_hardfork_versions();
-    daemon = create_and_start_daemon(daemon_params, result.name.str);
-    LOKI_ASSERT(daemon_print_sn_key(&daemon, &snode_key));
+    itest_ready_futures ready = start_daemon_async(daemon, 1, &daemon_params, 1, name);
 
     start_wallet_params wallet_params = {};
-    wallet_params.daemon              = &daemon;
-    wallet                            = create_and_start_wallet(daemon_params.nettype, wallet_params, result.name.str);
-    wallet_set_default_testing_settings(&wallet);
+    wallet_params.daemon              = daemon;
+    ready.push_back(create_and_start_wallet_async(wallet, daemon_params.nettype, wallet_params, name));
+    co_await itest_wait_until_ready_async(&ready);
+    co_await wallet_set_default_testing_settings_async(wallet);
   }
 
-  EXPECT(result, wallet_request_stake_unlock(&wallet, &snode_key) == false, "We should be unable to request a stake unlock on a node that is not registered");
-  return result;
+  loki_snode_key snode_key = {};
+  bool have_key            = co_await daemon_print_sn_key_async(daemon, &snode_key);
+  CO_EXPECT(result, have_key, "Failed to get the daemon's service node key");
+
+  bool requested = co_await wallet_request_stake_unlock_async(wallet, &snode_key);
+  CO_EXPECT(result, requested == false, "We should be unable to request a stake unlock on a node that is not registered");
+  co_return result;
+}
+
+LOKI_REGISTER_ASYNC_SCENARIO(latest__request_stake_unlock__disallow_request_on_non_existent_node, "staking unlock", ITEST_HF_LATEST, 1 /*daemons*/, 1 /*wallets*/);
+itest_task<test_result> latest__request_stake_unlock__disallow_request_on_non_existent_node()
+{
+  daemon_t daemon = create_daemon();
+  wallet_t wallet = {};
+  LOKI_DEFER { itest_ipc_clean_up(&daemon.ipc); itest_ipc_clean_up(&wallet.ipc); };
+
+  // NOTE: Can't co_await in a handler, and a cancelled scenario can't write exit to its processes
+  // anyway, so kill them and rethrow once out of it
+  test_result result       = {};
+  std::exception_ptr error = nullptr;
+  try
+  {
+    result = co_await disallow_request_on_non_existent_node_steps(&daemon, &wallet, __func__);
+  }
+  catch (...)
+  {
+    error = std::current_exception();
+  }
+
+  if (error)
+  {
+    itest_kill_process(wallet.pid);
+    itest_kill_process(daemon.pid);
+    std::rethrow_exception(error);
+  }
+
+  co_await wallet_exit_async(&wallet);
+  co_await daemon_exit_async(&daemon);
+  co_return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__request_stake_unlock__disallow_request_twice, "staking unlock", ITEST_HF_LATEST, 1 /*daemons*/, 1 /*wallets*/);
 test_result latest__request_stake_unlock__disallow_request_twice()
 {
   test_result result = {};
@@ -1944,6 +2430,7 @@ test_result latest__request_stake_unlock__disallow_request_twice()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__stake__allow_incremental_stakes_with_1_contributor, "staking", ITEST_HF_LATEST, 1 /*daemons*/, 1 /*wallets*/);
 test_result latest__stake__allow_incremental_stakes_with_1_contributor()
 {
   test_result result = {};
@@ -1992,6 +2479,7 @@ test_result latest__stake__allow_incremental_stakes_with_1_contributor()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__stake__check_incremental_stakes_decreasing_min_contribution, "staking", ITEST_HF_LATEST, 1 /*daemons*/, 5 /*wallets*/);
 test_result latest__stake__check_incremental_stakes_decreasing_min_contribution()
 {
   test_result result = {};
@@ -2147,6 +2635,7 @@ test_result latest__stake__check_incremental_stakes_decreasing_min_contribution(
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__stake__check_transfer_doesnt_used_locked_key_images, "staking transfer", ITEST_HF_LATEST, 1 /*daemons*/, 1 /*wallets*/);
 test_result latest__stake__check_transfer_doesnt_used_locked_key_images()
 {
   test_result result = {};
@@ -2164,6 +2653,7 @@ test_result latest__stake__check_transfer_doesnt_used_locked_key_images()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__stake__disallow_staking_less_than_minimum_in_pooled_node, "staking", ITEST_HF_LATEST, 1 /*daemons*/, 2 /*wallets*/);
 test_result latest__stake__disallow_staking_less_than_minimum_in_pooled_node()
 {
   test_result result = {};
@@ -2234,6 +2724,7 @@ test_result latest__stake__disallow_staking_less_than_minimum_in_pooled_node()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__stake__disallow_staking_when_all_amounts_reserved, "staking", ITEST_HF_LATEST, 1 /*daemons*/, 2 /*wallets*/);
 test_result latest__stake__disallow_staking_when_all_amounts_reserved()
 {
   test_result result = {};
@@ -2292,24 +2783,23 @@ test_result latest__stake__disallow_staking_when_all_amounts_reserved()
   return result;
 }
 
-test_result latest__stake__disallow_to_non_registered_node()
+// NOTE: The stake is rejected so the fixture is left as it was
+LOKI_REGISTER_FIXTURE_SCENARIO(latest__stake__disallow_to_non_registered_node, "staking", ITEST_HF_LATEST, latest_funded_wallet, read_only);
+test_result latest__stake__disallow_to_non_registered_node(helper_blockchain_environment *environment)
 {
   test_result result = {};
   INITIALISE_TEST_CONTEXT(result);
 
-  daemon_t daemon = {};
-  wallet_t wallet = {};
-  LOKI_DEFER { wallet_exit(&wallet); daemon_exit(&daemon); };
-
-  loki_addr my_addr = {};
-  helper_setup_blockchain_with_n_blocks(&result, &daemon, &wallet, &my_addr, 200);
+  daemon_t *daemon = environment->daemons + 0;
+  wallet_t *wallet = &environment->wallets[0];
 
   loki_snode_key snode_key = {};
-  daemon_print_sn_key(&daemon, &snode_key);
-  EXPECT(result, wallet_stake(&wallet, &snode_key, 15) == false, "You should not be able to stake to a node that is not registered yet!");
+  daemon_print_sn_key(daemon, &snode_key);
+  EXPECT(result, wallet_stake(wallet, &snode_key, 15) == false, "You should not be able to stake to a node that is not registered yet!");
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(latest__transfer__check_fee_amount_80x_increase, "transfer", ITEST_HF_LATEST, 1 /*daemons*/, 2 /*wallets*/);
 test_result latest__transfer__check_fee_amount_80x_increase()
 {
   test_result result = {};
@@ -2361,6 +2851,7 @@ test_result latest__transfer__check_fee_amount_80x_increase()
   return result;
 }
 
+LOKI_REGISTER_SCENARIO(v11__transfer__check_fee_amount_bulletproofs, "transfer", 11, 1 /*daemons*/, 2 /*wallets*/);
 test_result v11__transfer__check_fee_amount_bulletproofs()
 {
   test_result result = {};
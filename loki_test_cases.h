@@ -1,6 +1,8 @@
 #ifndef LOKI_TEST_CASES_H
 #define LOKI_TEST_CASES_H
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <vector>
 
@@ -10,6 +12,7 @@ struct test_result
 {
   loki_fixed_string<512> name;
   bool                   failed;
+  bool                   timed_out; // Cancelled by the watchdog, also marked failed
   loki_fixed_string<>    fail_msg;
   float                  duration_ms;
 };
@@ -36,14 +39,33 @@ struct helper_blockchain_environment
   std::vector<wallet_t>       wallets;
   std::vector<loki_addr>      wallets_addr;
 };
+// NOTE: When enabled, blockchains set up by helper_setup_blockchain are stored on disk keyed by the
+// setup parameters and the binaries, and later setups with the same key restore them instead of mining.
+extern bool helper_fixture_cache_enabled;
+
+// NOTE: When enabled, wallets created by helper_setup_blockchain are generated from a spend key derived
+// from the run seed, the scenario name and the wallet index instead of random keys. The same setup then
+// mines to the same addresses and produces the same registration commands every run. Cached fixtures
+// are then keyed by the scenario as well.
+extern bool     helper_deterministic_wallets;
+extern uint64_t helper_wallet_seed;
+
 void helper_cleanup_blockchain_environment(helper_blockchain_environment *environment);
-bool helper_setup_blockchain(helper_blockchain_environment *environment,
-                             test_result const *context,
-                             start_daemon_params daemon_param,
-                             int num_service_nodes,
-                             int num_daemons,
-                             int num_wallets,
-                             int wallet_balance);
+
+// NOTE: Wait until every daemon reports the same height and top block hash. Returns false and reports
+// where each daemon is stuck if they haven't converged within timeout_ms.
+bool helper_block_until_blockchains_are_synced(daemon_t *daemons, int num_daemons, int timeout_ms = 120 * 1000);
+
+// NOTE: Time spent waiting on helper_block_until_blockchains_are_synced in this process
+struct helper_sync_metrics
+{
+  std::atomic<int>      num_barriers;
+  std::atomic<int>      num_timeouts;
+  std::atomic<uint64_t> total_ms;
+  std::atomic<uint64_t> max_ms;
+};
+extern helper_sync_metrics helper_sync_stats;
+void helper_print_sync_metrics();
 
 // NOTE: The minimum amount such that spending funds is reliable and doesn't
 // error out with insufficient outputs to select from.
@@ -52,7 +74,102 @@ bool helper_setup_blockchain(helper_blockchain_environment *environment,
 // stricter now
 const int MIN_BLOCKS_IN_BLOCKCHAIN = 100;
 
+bool helper_setup_blockchain(helper_blockchain_environment *environment,
+                             test_result const *context,
+                             start_daemon_params daemon_param,
+                             int num_service_nodes,
+                             int num_daemons,
+                             int num_wallets,
+                             int wallet_balance,
+                             int num_blocks = MIN_BLOCKS_IN_BLOCKCHAIN); // Height the initial chain is mined to
+
 void        print_test_results(test_result const *results);
+
+// -------------------------------------------------------------------------------------------------
+//
+// Scenario Registry
+//
+// -------------------------------------------------------------------------------------------------
+typedef test_result(itest_scenario)(void);
+typedef itest_task<test_result>(itest_async_scenario)(void);
+typedef test_result(itest_fixture_scenario)(helper_blockchain_environment *environment);
+typedef bool(itest_fixture_setup)(helper_blockchain_environment *environment, test_result const *context);
+
+// NOTE: A named environment scenarios can ask for instead of setting one up themselves. The runner
+// sets it up once for all the scenarios that only read from it and runs them one after the other on
+// the same live processes. Scenarios that mutate it are given a private instance.
+struct itest_fixture_info
+{
+  itest_fixture_setup *setup;
+  char const          *name;
+  int                  daemons;
+  int                  wallets;
+};
+
+enum struct itest_fixture_use
+{
+  read_only,
+  mutates,
+};
+
+int const ITEST_HF_LATEST                   = 13;   // The last fork added by start_daemon_params::load_latest_hardfork_versions
+int const ITEST_DEFAULT_SCENARIO_TIMEOUT_S = 1200; // Generous, it's for catching wedged scenarios not slow ones
+
+struct itest_scenario_info
+{
+  itest_scenario       *scenario;
+  char const           *name;
+  char const           *tags;           // Space separated, i.e. "staking registration"
+  int                   hf_version;     // Hardfork the scenario runs at
+  int                   daemons;        // The most daemons the scenario runs at once
+  int                   wallets;        // The most wallets the scenario runs at once
+  int                   timeout_s;      // Wall clock deadline, the watchdog cancels the scenario and kills its processes after this
+  bool                  disabled;
+  itest_async_scenario *async_scenario; // Set instead of scenario for coroutines, they run on the event loops without holding a worker
+
+  itest_fixture_scenario   *fixture_scenario; // Set instead of scenario for scenarios run on a fixture
+  itest_fixture_info const *fixture;
+  itest_fixture_use         fixture_use;
+};
+
+std::vector<itest_scenario_info> &itest_scenario_registry(); // In definition order
+bool itest_scenario_has_tag(itest_scenario_info const *info, char const *tag);
+
+struct itest_scenario_registrar
+{
+  itest_scenario_registrar(itest_scenario_info const &info) { itest_scenario_registry().push_back(info); }
+};
+
+// NOTE: Place above the scenario's definition to add it to the registry
+#define LOKI_REGISTER_SCENARIO_(scenario, tags, hf_version, daemons, wallets, timeout_s, disabled) \
+  test_result scenario(); \
+  static itest_scenario_registrar const scenario##_registrar_({scenario, #scenario, tags, hf_version, daemons, wallets, timeout_s, disabled})
+#define LOKI_REGISTER_SCENARIO(scenario, tags, hf_version, daemons, wallets)                         LOKI_REGISTER_SCENARIO_(scenario, tags, hf_version, daemons, wallets, ITEST_DEFAULT_SCENARIO_TIMEOUT_S, false)
+#define LOKI_REGISTER_SCENARIO_WITH_TIMEOUT(scenario, tags, hf_version, daemons, wallets, timeout_s) LOKI_REGISTER_SCENARIO_(scenario, tags, hf_version, daemons, wallets, timeout_s, false)
+#define LOKI_REGISTER_DISABLED_SCENARIO(scenario, tags, hf_version, daemons, wallets)                LOKI_REGISTER_SCENARIO_(scenario, tags, hf_version, daemons, wallets, ITEST_DEFAULT_SCENARIO_TIMEOUT_S, true)
+
+// NOTE: Coroutine scenarios must only co_await the _async helpers, the blocking ones would stall the
+// event loop. INITIALISE_TEST_CONTEXT can't time a coroutine, the dispatcher fills in the duration.
+#define LOKI_REGISTER_ASYNC_SCENARIO(scenario, tags, hf_version, daemons, wallets) \
+  itest_task<test_result> scenario(); \
+  static itest_scenario_registrar const scenario##_registrar_({nullptr, #scenario, tags, hf_version, daemons, wallets, ITEST_DEFAULT_SCENARIO_TIMEOUT_S, false, scenario})
+
+// NOTE: EXPECT for coroutine scenarios. Asserting would abort every scenario sharing the event loop,
+// this only ends the one that failed.
+#define CO_EXPECT(test_result_var, expr, fmt, ...) \
+if (!(expr)) \
+{ \
+  test_result_var.failed   = true; \
+  test_result_var.fail_msg = loki_fixed_string<>("[" #expr "] " fmt, ## __VA_ARGS__); \
+  co_return test_result_var; \
+}
+
+// NOTE: The fixture must be defined above the registration, i.e.
+// itest_fixture_info const my_fixture = {my_fixture_setup, "my_fixture", 1 /*daemons*/, 1 /*wallets*/};
+#define LOKI_REGISTER_FIXTURE_SCENARIO(scenario, tags, hf_version, fixture, fixture_use) \
+  test_result scenario(helper_blockchain_environment *environment); \
+  static itest_scenario_registrar const scenario##_registrar_({nullptr, #scenario, tags, hf_version, fixture.daemons, fixture.wallets, ITEST_DEFAULT_SCENARIO_TIMEOUT_S, false, nullptr, scenario, &fixture, itest_fixture_use::fixture_use})
+
 //
 // Latest
 //
@@ -66,13 +183,13 @@ test_result latest__decommission__recommission_on_uptime_proof();
 
 test_result latest__deregistration__n_unresponsive_node();
 
-test_result latest__prepare_registration__check_solo_stake();
-test_result latest__prepare_registration__check_all_solo_stake_forms_valid_registration();
-test_result latest__prepare_registration__check_100_percent_operator_cut_stake();
+test_result latest__prepare_registration__check_solo_stake(helper_blockchain_environment *environment);
+test_result latest__prepare_registration__check_all_solo_stake_forms_valid_registration(helper_blockchain_environment *environment);
+test_result latest__prepare_registration__check_100_percent_operator_cut_stake(helper_blockchain_environment *environment);
 
 // TODO(doyle): We don't have any tests for blacklisted key images, because
 // I haven't got node deregistration working reliably in integration tests
-test_result latest__print_locked_stakes__check_no_locked_stakes();
+test_result latest__print_locked_stakes__check_no_locked_stakes(helper_blockchain_environment *environment);
 test_result latest__print_locked_stakes__check_shows_locked_stakes();
 
 test_result latest__register_service_node__allow_4_stakers();
@@ -85,7 +202,7 @@ test_result latest__register_service_node__check_unlock_time_is_0();
 
 test_result latest__request_stake_unlock__check_pooled_stake_unlocked();
 test_result latest__request_stake_unlock__check_unlock_height();
-test_result latest__request_stake_unlock__disallow_request_on_non_existent_node();
+itest_task<test_result> latest__request_stake_unlock__disallow_request_on_non_existent_node();
 test_result latest__request_stake_unlock__disallow_request_twice();
 
 test_result latest__stake__allow_incremental_stakes_with_1_contributor();
@@ -93,7 +210,7 @@ test_result latest__stake__check_incremental_stakes_decreasing_min_contribution(
 test_result latest__stake__check_transfer_doesnt_used_locked_key_images();
 test_result latest__stake__disallow_staking_less_than_minimum_in_pooled_node();
 test_result latest__stake__disallow_staking_when_all_amounts_reserved();
-test_result latest__stake__disallow_to_non_registered_node();
+test_result latest__stake__disallow_to_non_registered_node(helper_blockchain_environment *environment);
 test_result latest__transfer__check_fee_amount_80x_increase();
 
 //
@@ -19,10 +19,12 @@ struct wallet_params
 
 // TODO(doyle): This function should probably run by default since you almost always want it
 void                 wallet_set_default_testing_settings (wallet_t *wallet, wallet_params const params = {});
+itest_task<void>     wallet_set_default_testing_settings_async(wallet_t *wallet, wallet_params const params = {});
 bool                 wallet_address                      (wallet_t *wallet, int index, loki_addr *addr = nullptr); // Switch to subaddress at index
 bool                 wallet_address_new                  (wallet_t *wallet, loki_addr *addr);
 uint64_t             wallet_balance                      (wallet_t *wallet, uint64_t *unlocked_balance);
 void                 wallet_exit                         (wallet_t *wallet);
+itest_task<void>     wallet_exit_async                   (wallet_t *wallet);
 bool                 wallet_integrated_address           (wallet_t *wallet, loki_addr *addr);
 bool                 wallet_payment_id                   (wallet_t *wallet, loki_payment_id64 *id);
 
@@ -66,11 +68,11 @@ bool                 wallet_sweep_all                    (wallet_t *wallet, char
 bool                 wallet_transfer                     (wallet_t *wallet, char      const *dest, uint64_t amount, loki_transaction *tx); // TODO(doyle): We only support whole amounts. Not atomic units either.
 bool                 wallet_transfer                     (wallet_t *wallet, loki_addr const *dest, uint64_t amount, loki_transaction *tx);
 
-// TODO(doyle): We should be able to roughly calculate how much blocks we need to mine
-uint64_t             wallet_mine_until_unlocked_balance  (wallet_t *wallet, daemon_t *daemon, uint64_t desired_unlocked_balance, int blocks_between_check = LOKI_CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW);
+uint64_t             wallet_mine_until_unlocked_balance  (wallet_t *wallet, daemon_t *daemon, uint64_t desired_unlocked_balance); // Atomic units
 
 // TODO(doyle): This should return the transaction
 bool                 wallet_request_stake_unlock         (wallet_t *wallet, loki_snode_key const *snode_key, uint64_t *unlock_height = nullptr);
+itest_task<bool>     wallet_request_stake_unlock_async   (wallet_t *wallet, loki_snode_key const *snode_key, uint64_t *unlock_height = nullptr);
 bool                 wallet_register_service_node        (wallet_t *wallet, char const *registration_cmd, loki_transaction *tx = nullptr);
 
 #endif // LOKI_WALLET_H
@@ -85,10 +87,15 @@ bool                 wallet_register_service_node        (wallet_t *wallet, char
 
 void wallet_set_default_testing_settings(wallet_t *wallet, wallet_params const params)
 { 
+  itest_sync_wait(wallet_set_default_testing_settings_async(wallet, params));
+}
+
+itest_task<void> wallet_set_default_testing_settings_async(wallet_t *wallet, wallet_params const params)
+{
   loki_fixed_string<64> refresh_height("set refresh-from-block-height %zu", params.refresh_from_block_height);
-  itest_write_then_read_stdout_until(&wallet->ipc, refresh_height.str, LOKI_STRING("Wallet password"));
+  co_await itest_write_then_read_stdout_until_async(&wallet->ipc, refresh_height.str, LOKI_STRING("Wallet password"));
   loki_fixed_string<64> ask_password  ("set ask-password %d", params.disable_asking_password ? 0 : 1);
-  itest_write_to_stdin(&wallet->ipc, ask_password.str);
+  co_await itest_write_to_stdin_async(&wallet->ipc, ask_password.str);
 }
 
 bool wallet_address(wallet_t *wallet, int index, loki_addr *addr)
@@ -168,6 +175,12 @@ void wallet_exit(wallet_t *wallet)
   itest_ipc_clean_up(&wallet->ipc);
 }
 
+itest_task<void> wallet_exit_async(wallet_t *wallet)
+{
+  co_await itest_write_to_stdin_async(&wallet->ipc, "exit");
+  itest_ipc_clean_up(&wallet->ipc);
+}
+
 bool wallet_integrated_address(wallet_t *wallet, loki_addr *addr)
 {
   // Example
@@ -432,18 +445,24 @@ bool wallet_transfer(wallet_t *wallet, loki_addr const *dest, uint64_t amount, l
   return result;
 }
 
-uint64_t wallet_mine_until_unlocked_balance(wallet_t *wallet, daemon_t *daemon, uint64_t desired_unlocked_balance, int blocks_between_check)
+// NOTE: Mines the planned blocks in one go and checks the balance once. The planned reward is a lower
+// bound so it only goes around again if the plan was off. Funds that are mined but still locked count
+// towards the target, they unlock in the window mined on top of the plan.
+uint64_t wallet_mine_until_unlocked_balance(wallet_t *wallet, daemon_t *daemon, uint64_t desired_unlocked_balance)
 {
   uint64_t unlocked_balance = 0;
 
   loki_addr addr = {};
   if (wallet_address(wallet, 0, &addr))
   {
-    for (wallet_balance(wallet, &unlocked_balance); unlocked_balance < desired_unlocked_balance;)
+    for (uint64_t balance = wallet_balance(wallet, &unlocked_balance); unlocked_balance < desired_unlocked_balance; balance = wallet_balance(wallet, &unlocked_balance))
     {
-      daemon_mine_n_blocks(daemon, &addr, blocks_between_check);
+      uint64_t const shortfall = (balance < desired_unlocked_balance) ? desired_unlocked_balance - balance : 0;
+      uint64_t blocks          = loki_blocks_until_unlocked_reward(daemon_status(daemon).height, shortfall);
+      if (blocks == 0) blocks  = LOKI_CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW;
+
+      daemon_mine_n_blocks(daemon, &addr, static_cast<int>(blocks));
       wallet_refresh(wallet);
-      wallet_balance(wallet, &unlocked_balance);
     }
   }
 
@@ -451,6 +470,12 @@ uint64_t wallet_mine_until_unlocked_balance(wallet_t *wallet, daemon_t *daemon,
 }
 
 bool wallet_request_stake_unlock(wallet_t *wallet, loki_snode_key const *snode_key, uint64_t *unlock_height)
+{
+  bool result = itest_sync_wait(wallet_request_stake_unlock_async(wallet, snode_key, unlock_height));
+  return result;
+}
+
+itest_task<bool> wallet_request_stake_unlock_async(wallet_t *wallet, loki_snode_key const *snode_key, uint64_t *unlock_height)
 {
   itest_read_possible_value const possible_values[] =
   {
@@ -465,10 +490,10 @@ bool wallet_request_stake_unlock(wallet_t *wallet, loki_snode_key const *snode_k
   };
 
   loki_fixed_string<256> cmd("request_stake_unlock %s", snode_key->str);
-  itest_read_result output = itest_write_then_read_stdout_until(&wallet->ipc, cmd.str, possible_values, LOKI_ARRAY_COUNT(possible_values));
+  itest_read_result output = co_await itest_write_then_read_stdout_until_async(&wallet->ipc, cmd.str, possible_values, LOKI_ARRAY_COUNT(possible_values));
 
   if (possible_values[output.matching_find_strs_index].is_fail_msg)
-    return false;
+    co_return false;
 
   if (unlock_height)
   {
@@ -482,8 +507,8 @@ bool wallet_request_stake_unlock(wallet_t *wallet, loki_snode_key const *snode_k
     {LOKI_STRING("Error: Reason: "), true},
     {LOKI_STRING("You can check its status by using the `show_transfers` command"), false},
   };
-  output = itest_write_then_read_stdout_until(&wallet->ipc, "y", possible_values2, LOKI_ARRAY_COUNT(possible_values2));
-  return !possible_values2[output.matching_find_strs_index].is_fail_msg;
+  output = co_await itest_write_then_read_stdout_until_async(&wallet->ipc, "y", possible_values2, LOKI_ARRAY_COUNT(possible_values2));
+  co_return !possible_values2[output.matching_find_strs_index].is_fail_msg;
 }
 
 bool wallet_register_service_node(wallet_t *wallet, char const *registration_cmd, loki_transaction *tx)